@@ -17,7 +17,7 @@ void AsyncOctreeWriter::add(Node* node, bool in_core) {
 			octree_write_lock.unlock();
 			// Remove points
 			num_points_in_core -= node->points.size();
-			std::vector<Point>().swap(node->points);
+			PointBuffer().swap(node->points);
 		}
 		else {
 			std::string path = get_full_point_file(node->id, output_path);
@@ -0,0 +1,115 @@
+#include "AttributeSchema.h"
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+
+static const AttributeSchema::Attribute all_attributes[] = {
+	AttributeSchema::Attribute::INTENSITY,
+	AttributeSchema::Attribute::CLASSIFICATION,
+	AttributeSchema::Attribute::RETURN_NUMBER,
+	AttributeSchema::Attribute::NUMBER_OF_RETURNS,
+	AttributeSchema::Attribute::GPS_TIME,
+};
+
+AttributeSchema AttributeSchema::parse(const std::string& list) {
+	AttributeSchema schema;
+	if (list == "all") {
+		schema.attributes.assign(std::begin(all_attributes), std::end(all_attributes));
+		return schema;
+	}
+
+	std::stringstream stream(list);
+	std::string name;
+	while (std::getline(stream, name, ',')) {
+		if (name.empty()) continue;
+		bool found = false;
+		for (Attribute a : all_attributes) {
+			if (name == get_name(a)) {
+				schema.attributes.push_back(a);
+				found = true;
+				break;
+			}
+		}
+		if (!found) throw std::runtime_error("Unknown attribute '" + name + "'");
+	}
+	return schema;
+}
+
+const char* AttributeSchema::get_name(Attribute attribute) {
+	switch (attribute) {
+	case Attribute::INTENSITY: return "intensity";
+	case Attribute::CLASSIFICATION: return "classification";
+	case Attribute::RETURN_NUMBER: return "return_number";
+	case Attribute::NUMBER_OF_RETURNS: return "number_of_returns";
+	case Attribute::GPS_TIME: return "gps_time";
+	}
+	return "";
+}
+
+const char* AttributeSchema::get_type(Attribute attribute) {
+	switch (attribute) {
+	case Attribute::INTENSITY: return "uint16";
+	case Attribute::GPS_TIME: return "float64";
+	default: return "uint8";
+	}
+}
+
+uint32_t AttributeSchema::get_size(Attribute attribute) {
+	switch (attribute) {
+	case Attribute::INTENSITY: return sizeof(uint16_t);
+	case Attribute::GPS_TIME: return sizeof(double);
+	default: return sizeof(uint8_t);
+	}
+}
+
+std::vector<uint32_t> AttributeSchema::get_strides() const {
+	std::vector<uint32_t> strides;
+	for (Attribute a : attributes) strides.push_back(get_size(a));
+	return strides;
+}
+
+std::string AttributeSchema::to_string() const {
+	std::string list;
+	for (Attribute a : attributes) {
+		if (!list.empty()) list += ",";
+		list += get_name(a);
+	}
+	return list;
+}
+
+void AttributeSchema::encode(size_t i, const PointAttributes& a, uint8_t* dst) const {
+	switch (attributes[i]) {
+	case Attribute::INTENSITY: memcpy(dst, &a.intensity, sizeof(uint16_t)); break;
+	case Attribute::CLASSIFICATION: *dst = a.classification; break;
+	case Attribute::RETURN_NUMBER: *dst = a.return_number; break;
+	case Attribute::NUMBER_OF_RETURNS: *dst = a.number_of_returns; break;
+	case Attribute::GPS_TIME: memcpy(dst, &a.gps_time, sizeof(double)); break;
+	}
+}
+
+void AttributeSchema::decode(size_t i, const uint8_t* src, PointAttributes& a) const {
+	switch (attributes[i]) {
+	case Attribute::INTENSITY: memcpy(&a.intensity, src, sizeof(uint16_t)); break;
+	case Attribute::CLASSIFICATION: a.classification = *src; break;
+	case Attribute::RETURN_NUMBER: a.return_number = *src; break;
+	case Attribute::NUMBER_OF_RETURNS: a.number_of_returns = *src; break;
+	case Attribute::GPS_TIME: memcpy(&a.gps_time, src, sizeof(double)); break;
+	}
+}
+
+void AttributeSchema::append(const PointAttributes& a, AttributeColumns& columns) const {
+	for (size_t i = 0; i < attributes.size(); i++) {
+		std::vector<uint8_t>& column = columns.columns[i];
+		column.resize(column.size() + get_size(attributes[i]));
+		encode(i, a, &column[column.size() - get_size(attributes[i])]);
+	}
+}
+
+void AttributeSchema::save(const std::string& path) const {
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file) throw std::runtime_error("Could not open attribute file");
+	for (Attribute a : attributes) {
+		fprintf(file, "%s %s\n", get_name(a), get_type(a));
+	}
+	fclose(file);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Data.h"
+
+// The point attributes that are carried through the build in addition to position and
+// color. Every attribute is written to its own file per node (p<id>.<name>.bin), in the
+// same order as the points, so consumers only need to read the columns they use.
+class AttributeSchema {
+public:
+	enum class Attribute : uint8_t {
+		INTENSITY,
+		CLASSIFICATION,
+		RETURN_NUMBER,
+		NUMBER_OF_RETURNS,
+		GPS_TIME,
+	};
+
+private:
+	std::vector<Attribute> attributes;
+
+public:
+	// Parse a comma separated list of attribute names, or "all"
+	static AttributeSchema parse(const std::string& list);
+
+	static const char* get_name(Attribute attribute);
+	static const char* get_type(Attribute attribute);
+	static uint32_t get_size(Attribute attribute);
+
+	size_t size() const { return attributes.size(); }
+	bool empty() const { return attributes.empty(); }
+	Attribute get(size_t i) const { return attributes[i]; }
+	std::vector<uint32_t> get_strides() const;
+	std::string to_string() const;
+
+	// Store attribute i of a point at dst
+	void encode(size_t i, const PointAttributes& a, uint8_t* dst) const;
+	// Read attribute i of a point from src
+	void decode(size_t i, const uint8_t* src, PointAttributes& a) const;
+	// Append the values of a point to every column
+	void append(const PointAttributes& a, AttributeColumns& columns) const;
+
+	// Describe the columns in the output directory, one "<name> <type>" line per attribute
+	void save(const std::string& path) const;
+};
@@ -1,21 +1,30 @@
 #include "Builder.h"
-
-#define MAX_POINTS_IN_CORE 80'000'000
+#include "Distributed.h"
+#include "HierarchyWriter.h"
+#include <cmath>
+
+// In-core subtrees with more points than this are split in their own job
+#define IC_JOB_MIN_POINTS 100'000
+// Write jobs free memory, so they are started before any split job
+#define WRITE_JOB_PRIORITY UINT64_MAX
+// Adaptive split policy: a node is kept as a leaf if all of its children would have less than
+// max_node_size / LEAF_MERGE_DIVISOR points, and sparse nodes may hold up to
+// MAX_CAPACITY_FACTOR * max_node_size points
+#define LEAF_MERGE_DIVISOR 4
+#define MAX_CAPACITY_FACTOR 4
+
+uint64_t Builder::get_job_priority(uint64_t num_points) {
+	if (!options.priority_scheduling) return 0;
+	// Estimated remaining work: every level of the subtree touches all of its points once
+	uint64_t depth = 1;
+	for (uint64_t n = num_points; n > max_node_size; n /= 8) depth++;
+	return num_points * depth;
+}
 
 void Builder::ic_load_points(Node* node) {
-	FILE* points_file = fopen(get_full_point_file(node->id, output_path).c_str(), "rb");
-	if (!points_file) throw std::runtime_error("Could not open file");
-
 	num_points_in_core += node->num_points;
-	node->points.resize(node->num_points);
-
-	Point p;
-	for (uint64_t i = 0; i < node->num_points; i++) {
-		if (!fread(&p, sizeof(struct Point), 1, points_file)) break;
-		node->points[i] = p;
-	}
-
-	fclose(points_file);
+	read_node_file(get_full_point_file(node->id, output_path), options.attributes, node->num_points,
+		node->points, node->attributes);
 }
 
 uint8_t Builder::find_child_node_index(Cube& bounds, Point& p) {
@@ -26,11 +35,12 @@ uint8_t Builder::find_child_node_index(Cube& bounds, Point& p) {
 	return index;
 }
 
-Node* Builder::create_child_node(std::string id, uint64_t num_points, std::vector<Point> points, float center_x, float center_y, float center_z, float size) {
+Node* Builder::create_child_node(std::string id, uint64_t num_points, PointBuffer&& points, AttributeColumns&& attributes, float center_x, float center_y, float center_z, float size) {
 	Node* node = new Node();
 	node->id = id;
 	node->num_points = num_points;
-	node->points = points;
+	node->points = std::move(points);
+	node->attributes = std::move(attributes);
 	node->bounds.center_x = center_x;
 	node->bounds.center_y = center_y;
 	node->bounds.center_z = center_z;
@@ -38,70 +48,173 @@ Node* Builder::create_child_node(std::string id, uint64_t num_points, std::vecto
 	return node;
 }
 
-uint64_t Builder::ic_sample_node(Node* node) {
-	/*FILE* points_file = fopen(get_full_point_file(node->id, output_path).c_str(), "wb");
-	if (!points_file) throw std::runtime_error("Could not open file");*/
-
-	uint64_t to_sample = (std::min(sampled_node_size, (uint32_t)node->points.size()));
-	uint64_t sample_interval = node->points.size() / to_sample;
+uint64_t Builder::ic_sample_node(Node* node, const std::vector<uint64_t>& selected) {
+	uint64_t to_sample = selected.size();
 
-	std::vector<Point> sampled_points;
-	sampled_points.resize(to_sample);
+	PointBuffer sampled_points(to_sample);
 
 	for (uint64_t i = 0; i < to_sample; i++) {
-		//fwrite(&node->points[i * sample_interval], sizeof(struct Point), 1, points_file);
-		//sampled_points[i] = node->points[i * sample_interval];
-		sampled_points[i] = node->points[i];
+		sampled_points[i] = node->points[selected[i]];
 	}
 
-	//fclose(points_file);
 	node->points.swap(sampled_points);
+	if (!node->attributes.empty()) {
+		AttributeColumns sampled_attributes;
+		sampled_attributes.gather(node->attributes, selected);
+		std::swap(node->attributes, sampled_attributes);
+	}
 	node->num_points = node->points.size();
 
-	//writer.add_num_points_in_core(node->points.size());
-	num_points_in_core += node->points.size();
+	// Without redundancy the sampled points were taken out of the children, so they are already counted
+	if (!options.non_redundant) num_points_in_core += node->points.size();
 
 	write_node(node, true);
 
 	return to_sample;
 }
 
+// Remove points that quantize to the same cell as an earlier point of the node, returns the number removed
+uint64_t Builder::ic_remove_duplicates(Node* node) {
+	struct Entry {
+		int32_t x, y, z;
+		uint64_t index;
+		bool operator<(const Entry& o) const {
+			if (x != o.x) return x < o.x;
+			if (y != o.y) return y < o.y;
+			if (z != o.z) return z < o.z;
+			return index < o.index;
+		}
+		bool same_cell(const Entry& o) const { return x == o.x && y == o.y && z == o.z; }
+	};
+	thread_local std::vector<Entry> entries;
+	thread_local std::vector<uint64_t> kept;
+
+	double scale = 1.0 / options.duplicate_tolerance;
+	double min_x = node->bounds.center_x - node->bounds.size;
+	double min_y = node->bounds.center_y - node->bounds.size;
+	double min_z = node->bounds.center_z - node->bounds.size;
+
+	entries.resize(node->points.size());
+	for (uint64_t i = 0; i < node->points.size(); i++) {
+		const Point& p = node->points[i];
+		entries[i] = { (int32_t)std::floor((p.x - min_x) * scale), (int32_t)std::floor((p.y - min_y) * scale),
+			(int32_t)std::floor((p.z - min_z) * scale), i };
+	}
+	std::sort(entries.begin(), entries.end());
+
+	kept.clear();
+	for (uint64_t i = 0; i < entries.size(); i++) {
+		if (i == 0 || !entries[i].same_cell(entries[i - 1])) kept.push_back(entries[i].index);
+	}
+	uint64_t removed = node->points.size() - kept.size();
+	if (removed == 0) return 0;
+
+	// Keep the input order of the remaining points
+	std::sort(kept.begin(), kept.end());
+	PointBuffer points(kept.size());
+	for (uint64_t i = 0; i < kept.size(); i++) points[i] = node->points[kept[i]];
+	node->points.swap(points);
+	if (!node->attributes.empty()) {
+		AttributeColumns attributes;
+		attributes.gather(node->attributes, kept);
+		std::swap(node->attributes, attributes);
+	}
+	node->num_points = node->points.size();
+
+	num_points_in_core -= removed;
+	duplicates_removed += removed;
+	return removed;
+}
+
 void Builder::ic_split_node(Node* node, bool is_async) {
 	if (node->num_points > max_node_size) {
-		if (node->num_points > 1'000'000 && !is_async) {
-			pool.add_job([this, node] {
+		if (node->num_points > IC_JOB_MIN_POINTS && !is_async) {
+			add_job(pool, [this, node] {
 				ic_split_node(node, true);
-			});
+			}, get_job_priority(node->num_points));
+			return;
+		}
+		// All points of the subtree pass through here, while they are still in cache
+		if (node->stats.empty()) node->stats.add(node->points.data(), node->points.size());
+
+		// Child of every point, the attribute columns are partitioned the same way as the points
+		const uint8_t NO_CHILD = 0xFF;
+		std::vector<uint8_t> child_index(node->num_points);
+		uint64_t num_child_points[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		for (uint64_t i = 0; i < node->num_points; i++) {
+			child_index[i] = find_child_node_index(node->bounds, node->points[i]);
+			num_child_points[child_index[i]]++;
+		}
+		if (options.adaptive_split && keep_as_leaf(node, num_child_points)) {
+			ic_write_leaf(node);
 			return;
 		}
-		std::vector<Point> child_points[8];
-		/*for (int i = 0; i < 8; i++) {
-			child_points[i].reserve(node->num_points / 4);
-		}*/
 
+		// Sample uniformly over the node cube, the sampler's scratch grid is reused by this thread
+		thread_local std::vector<uint64_t> selected;
+		GridSampler::for_thread().select(node->points.data(), node->points.size(), node->bounds, sampled_node_size, selected);
+
+		// Without redundancy sampled points are stored in this node only, the children get the rest
+		if (options.non_redundant) {
+			for (uint64_t i : selected) {
+				num_child_points[child_index[i]]--;
+				child_index[i] = NO_CHILD;
+			}
+		}
+
+		// Size the child buffers up front, so each one is taken from the pool once
+		PointBuffer child_points[8];
+		for (int i = 0; i < 8; i++) child_points[i].reserve(num_child_points[i]);
 		for (uint64_t i = 0; i < node->num_points; i++) {
-			child_points[find_child_node_index(node->bounds, node->points[i])].push_back(node->points[i]);
+			if (child_index[i] != NO_CHILD) child_points[child_index[i]].push_back(node->points[i]);
+		}
+
+		AttributeColumns child_attributes[8];
+		if (!node->attributes.empty()) {
+			for (int i = 0; i < 8; i++) {
+				child_attributes[i].init(node->attributes.strides);
+				for (size_t c = 0; c < node->attributes.strides.size(); c++) {
+					child_attributes[i].columns[c].reserve(num_child_points[i] * node->attributes.strides[c]);
+				}
+			}
+			for (size_t c = 0; c < node->attributes.columns.size(); c++) {
+				uint32_t stride = node->attributes.strides[c];
+				const uint8_t* column = node->attributes.columns[c].data();
+				for (uint64_t i = 0; i < node->num_points; i++) {
+					if (child_index[i] == NO_CHILD) continue;
+					std::vector<uint8_t>& dst = child_attributes[child_index[i]].columns[c];
+					dst.insert(dst.end(), column + i * stride, column + (i + 1) * stride);
+				}
+			}
 		}
 
 		node->child_nodes = new Node*[8];
 		for (int i = 0; i < 8; i++) {
-			if (child_points[i].size() != 0) {
+			if (num_child_points[i] != 0) {
 				std::string id = node->id;
 				id.append(std::to_string(i));
-				Node* child_node = create_child_node(id, child_points[i].size(), child_points[i],
+				Node* child_node = create_child_node(id, num_child_points[i], std::move(child_points[i]), std::move(child_attributes[i]),
 					node->bounds.center_x + (-(node->bounds.size / 2.0f) + ((i & (1 << 2)) ? node->bounds.size : 0)),
 					node->bounds.center_y + (-(node->bounds.size / 2.0f) + ((i & (1 << 1)) ? node->bounds.size : 0)),
 					node->bounds.center_z + (-(node->bounds.size / 2.0f) + ((i & (1 << 0)) ? node->bounds.size : 0)),
 					node->bounds.size / 2.0f);
+				if (options.adaptive_split) {
+					child_node->stats.add(child_node->points.data(), child_node->points.size());
+					skip_single_octant_levels(child_node);
+				}
 
 				node->child_nodes_mask |= (1 << i);
 				node->child_nodes[i] = child_node;
 			}
 		}
 
-		node->num_points = ic_sample_node(node);
+		node->num_points = ic_sample_node(node, selected);
+		if (options.non_redundant) points_processed += node->num_points;
 
-		for (int i = 0; i < 8; i++) {
+		// Largest subtrees first, large ones get their own job and the small ones are split right here
+		int order[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+		std::sort(order, order + 8, [&](int a, int b) { return num_child_points[a] > num_child_points[b]; });
+		for (int i : order) {
 			if (node->child_nodes_mask & (1 << i)) {
 				ic_split_node(node->child_nodes[i], false);
 			}
@@ -115,67 +228,212 @@ void Builder::ic_split_node(Node* node, bool is_async) {
 		for (uint64_t i = 0; i < node->num_points; i++) {
 			fwrite(&node->points[i], sizeof(struct Point), 1, points_file);
 		}
-		std::vector<Point>().swap(node->points); // Clear points and free memory
+		PointBuffer().swap(node->points); // Clear points and free memory
 
 		fclose(points_file);*/
-		write_node(node, true);
-		points_processed += node->num_points;
+		if (node->stats.empty()) node->stats.add(node->points.data(), node->points.size());
+		ic_write_leaf(node);
 	}
 }
 
+void Builder::ic_write_leaf(Node* node) {
+	// Removed points count as processed, the build is done once every input point is accounted for
+	uint64_t removed = options.duplicate_tolerance > 0.0 ? ic_remove_duplicates(node) : 0;
+	write_node(node, true);
+	points_processed += node->num_points + removed;
+}
+
+// Adaptive split policy: decide whether a node with more than max_node_size points stays a
+// leaf, given the number of its points in every octant
+bool Builder::keep_as_leaf(Node* node, const uint64_t num_child_points[8]) {
+	// Undersized siblings are merged back into one leaf, which holds at most
+	// 8 * max_node_size / LEAF_MERGE_DIVISOR points
+	uint64_t largest = *std::max_element(num_child_points, num_child_points + 8);
+	if (largest * LEAF_MERGE_DIVISOR < max_node_size) return true;
+
+	// Points that cover more than the area of one face of the cube (vegetation, scans of
+	// volumes) are spread over more octants by every split, so such nodes get more room
+	if (node->num_points > (uint64_t)max_node_size * MAX_CAPACITY_FACTOR) return false;
+	float spacing = GridSampler::estimate_spacing(node->points.data(), node->points.size(), node->bounds);
+	float edge = node->bounds.size * 2.0f;
+	double faces = (double)node->num_points * spacing * spacing / ((double)edge * edge);
+	return node->num_points <= max_node_size * std::clamp(faces, 1.0, (double)MAX_CAPACITY_FACTOR);
+}
+
+// Move a node that is going to be split down to the octant that holds all of its points for
+// as long as there is one, so no chain of nodes with a single child is written. The points
+// have to be in the stats of the node.
+void Builder::skip_single_octant_levels(Node* node) {
+	// The nodes down to the distribution depth are the roots of the subtrees of the workers
+	if (node->num_points <= max_node_size || node->id.size() <= options.distribute_depth) return;
+
+	const Bounds& b = node->stats.bounds;
+	while (node->skipped_levels < UINT8_MAX) {
+		const Cube& c = node->bounds;
+		// Same rule as find_child_node_index, points on the center plane go to the lower half
+		bool upper_x = b.min_x > c.center_x, upper_y = b.min_y > c.center_y, upper_z = b.min_z > c.center_z;
+		if ((!upper_x && b.max_x > c.center_x) || (!upper_y && b.max_y > c.center_y) || (!upper_z && b.max_z > c.center_z)) break;
+
+		uint8_t octant = (upper_x ? (1 << 2) : 0) | (upper_y ? (1 << 1) : 0) | (upper_z ? (1 << 0) : 0);
+		Cube child = c.get_octant(octant);
+		// The points are closer to each other than floats can divide the cube
+		if (child.size == 0.0f || (child.center_x == c.center_x && child.center_y == c.center_y && child.center_z == c.center_z)) break;
+
+		node->bounds = child;
+		node->id += std::to_string(octant);
+		node->skipped_levels++;
+	}
+}
+
+void Builder::add_job(ThreadPool& target, std::function<void()> job, uint64_t priority) {
+	target.add_job([this, job] {
+		if (failed) return;
+		try {
+			job();
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> guard(error_lock);
+			if (!build_error) build_error = std::current_exception();
+			failed = true;
+		}
+	}, priority);
+}
+
 void Builder::write_node(Node* node, bool in_core) {
-	pool.add_job([this, node, in_core] {
-		//auto start = std::chrono::high_resolution_clock::now();
-		//octree_file_lock.lock();
-		if (!in_core) return;
+	add_job(io_pool, [this, node, in_core] {
+		write_node_file(node, in_core);
+	}, WRITE_JOB_PRIORITY);
+	//writer.add(node, in_core);
+}
 
-		FILE* octree_file = fopen(get_full_point_file(node->id, output_path).c_str(), "wb");
-		if (!octree_file) THROW_FILE_OPEN_ERROR;
+void Builder::write_node_file(Node* node, bool in_core) {
+	//auto start = std::chrono::high_resolution_clock::now();
+	//octree_file_lock.lock();
+	std::string point_file = get_full_point_file(node->id, output_path);
+	if (!in_core) {
+		// The points are already in their file, load them for their statistics and to bring them into order
+		PointBuffer points;
+		AttributeColumns attributes;
+		read_node_file(point_file, options.attributes, node->num_points, points, attributes);
+		// Nodes that were split out-of-core got their bounds while their points were streamed
+		if (node->stats.empty()) node->stats.add(points.data(), points.size());
+		node->stats.spacing = GridSampler::estimate_spacing(points.data(), points.size(), node->bounds);
+		if (!options.morton_order) return;
+		MortonSorter::for_thread().sort(points, attributes, node->bounds);
+		NodeFileWriter writer(point_file, options.attributes);
+		writer.write(points, attributes);
+		if (options.morton_index_depth) write_block_index(point_file, MortonSorter::for_thread(), options.morton_index_depth);
+		return;
+	}
+
+	node->stats.spacing = GridSampler::estimate_spacing(node->points.data(), node->points.size(), node->bounds);
+	if (options.morton_order) {
+		MortonSorter::for_thread().sort(node->points, node->attributes, node->bounds);
+		if (options.morton_index_depth) write_block_index(point_file, MortonSorter::for_thread(), options.morton_index_depth);
+	}
+	{
+		NodeFileWriter writer(point_file, options.attributes);
 
 		//open_octree_files++;
 		//node->byte_index = octree_file_cursor;
 		//octree_file_cursor += node->num_points * sizeof(struct Point);
 
 		//fseek(octree_file, node->byte_index, SEEK_SET);
-		fwrite(&node->points[0], sizeof(struct Point), node->points.size(), octree_file);
-
-		{ std::vector<Point>().swap(node->points); }
-		num_points_in_core -= node->num_points;
-		/*else {
-			std::string path = get_full_point_file(node->id, output_path);
-			FILE* node_points_file = fopen(path.c_str(), "rb");
-			if (!node_points_file) THROW_FILE_OPEN_ERROR;
-
-			for (uint64_t i = 0; i < node->num_points; i++) {
-				Point p;
-				fread(&p, sizeof(struct Point), 1, node_points_file);
-				fwrite(&p, sizeof(struct Point), 1, octree_file);
-			}
-			fclose(node_points_file);
+		writer.write(node->points, node->attributes);
+	}
 
-			std::filesystem::remove(path);
-		}*/
-		fclose(octree_file);
-		//uint64_t end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
-		//open_octree_files--;
+	{ PointBuffer().swap(node->points); }
+	node->attributes.free();
+	num_points_in_core -= node->num_points;
+	/*else {
+		std::string path = get_full_point_file(node->id, output_path);
+		FILE* node_points_file = fopen(path.c_str(), "rb");
+		if (!node_points_file) THROW_FILE_OPEN_ERROR;
 
-		//octree_file_lock.unlock();
-	});
-	//writer.add(node, in_core);
+		for (uint64_t i = 0; i < node->num_points; i++) {
+			Point p;
+			fread(&p, sizeof(struct Point), 1, node_points_file);
+			fwrite(&p, sizeof(struct Point), 1, octree_file);
+		}
+		fclose(node_points_file);
+
+		std::filesystem::remove(path);
+	}*/
+	//uint64_t end = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+	//open_octree_files--;
+
+	//octree_file_lock.unlock();
+}
+
+std::unique_ptr<PointReader> Builder::open_input_reader(const std::string& file, const InputManifest* manifest, uint16_t text_threads) {
+	switch (get_point_file_format(file)) {
+	case POINT_FILE_FORMAT_LAS: {
+		std::unique_ptr<LasPointReader> r(new LasPointReader);
+		// Skip parsing the header again if it is already known from the manifest
+		const LasHeader* header = manifest ? manifest->find(file) : nullptr;
+		if (header) r->open(file, *header);
+		else r->open(file);
+		return r;
+	}
+	case POINT_FILE_FORMAT_LAZ: {
+		std::unique_ptr<LazPointReader> r(new LazPointReader);
+		const LasHeader* header = manifest ? manifest->find(file) : nullptr;
+		if (header) r->open(file, *header);
+		else r->open(file);
+		return r;
+	}
+	case POINT_FILE_FORMAT_PTS: {
+		std::unique_ptr<TextPointReader> r(new TextPointReader(text_threads));
+		r->open(file);
+		return r;
+	}
+	default:
+		throw std::runtime_error("Unsupported input file '" + file + "'");
+	}
+}
+
+std::unique_ptr<PointReader> Builder::open_raw_reader(const std::string& file) {
+	std::unique_ptr<PointReader> r(new RawPointReader(&options.attributes));
+	r->open(file);
+	return r;
+}
+
+std::unique_ptr<PointReader> Builder::open_input(size_t i, uint16_t text_threads) {
+	if (i < input_paths.size()) return open_input_reader(input_paths[i], manifest, text_threads);
+	return std::unique_ptr<PointReader>(new MemoryPointReader(input_batches[i - input_paths.size()]));
+}
+
+std::string Builder::get_input_name(size_t i) const {
+	if (i < input_paths.size()) return input_paths[i];
+	return "batch " + std::to_string(i - input_paths.size());
+}
+
+void Builder::add_input_batch(std::shared_ptr<const PointBatch> batch) {
+	input_batches.push_back(batch);
 }
 
 void Builder::split_node(Node* node, bool is_async) {
-	split_node(node, is_async, false, std::vector<std::string>());
+	split_node(node, is_async, false);
 }
 
-void Builder::split_node(Node* node, bool is_async, bool is_las, std::vector<std::string> input_files) {
+void Builder::split_node(Node* node, bool is_async, bool is_input) {
 	if (node->num_points > max_node_size) {
-		if (node->id != "" && num_points_in_core.load() + node->num_points < MAX_POINTS_IN_CORE) {
+		if (options.distribute_depth && node->id.size() == options.distribute_depth) {
+			// Leave this subtree to a worker, its points stay in the point file of the node
+			submit_job(output_path, node);
+			std::lock_guard<std::mutex> guard(remote_nodes_lock);
+			remote_nodes.push_back(node);
+			points_processed += node->num_points;
+			return;
+		}
+		// Above the distribution depth nodes are split out-of-core, so that large subtrees end up with the workers
+		bool may_split_in_core = node->id != "" && node->id.size() >= options.distribute_depth;
+		if (may_split_in_core && num_points_in_core.load() + node->num_points < options.max_points_in_core) {
 			//if (num_points_in_core < 75'000'000) { // Ensure that a maximum of ~80M points are in memory at the same time
 			// Split this node in-core
 			ic_load_points(node);
 
-			std::filesystem::remove(get_full_point_file(node->id, output_path));
+			remove_node_file(get_full_point_file(node->id, output_path), options.attributes);
 
 			ic_split_node(node, false);
 			return;
@@ -183,86 +441,95 @@ void Builder::split_node(Node* node, bool is_async, bool is_las, std::vector<std
 		}
 		else if (!is_async) {
 			// Run async
-			pool.add_job([this, node] {
+			add_job(pool, [this, node] {
 				Logger::add_thread_alias("BLDA");
-				try {
-					split_node(node, true);
-				}
-				catch (const std::exception exc) {
-					Logger::log_error("Error splitting Node: " + std::string(exc.what()));
-				}
-			});
+				split_node(node, true);
+			}, get_job_priority(node->num_points));
 			return;
 		}
 
 
 		/*FILE* points_file = fopen(get_full_point_file(node->id, output_path).c_str(), "rb");
 		if (!points_file) throw std::runtime_error("Could not open file");*/
-		if (!is_las) {
-			input_files.push_back(get_full_point_file(node->id, output_path));
-		}
 
 		// Since we will split this node, we can sample it now
-		FILE* sample_file = fopen(get_full_temp_point_file(node->id, output_path).c_str(), "wb");
-		if (!sample_file) throw std::runtime_error("Could not open file");
+		StreamingGridSampler sampler(node->bounds, sampled_node_size);
+		std::vector<std::pair<Point, PointAttributes>> evicted;
 
-		FILE* child_point_files[8] = { nullptr };
+		std::unique_ptr<NodeFileWriter> child_point_files[8];
 		uint64_t num_child_points[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		NodeStats child_stats[8];
 
-		uint64_t i = 0;
-		uint64_t sampled_points = 0;
-		uint64_t sample_interval = (int)((double)node->num_points / (double)sampled_node_size);
-
-		for (std::string file : input_files) {
-			if (input_files.size() > 1) Logger::log_info("Reading file '" + std::filesystem::path(file).filename().string() + "'");
-			//BufferedPointReader reader(file, is_las ? POINT_FILE_FORMAT_LAS : POINT_FILE_FORMAT_RAW, 1'000'000);
-			std::unique_ptr<PointReader> r;
-			if (is_las) {
-				r = std::unique_ptr<LasPointReader>(new LasPointReader);
+		auto write_to_child = [&](Point& p, const PointAttributes& a) {
+			uint8_t index = find_child_node_index(node->bounds, p);
+			if (!child_point_files[index]) {
+				child_point_files[index].reset(new NodeFileWriter(
+					get_full_point_file(node->id + std::to_string(index), output_path), options.attributes));
 			}
-			else {
-				r = std::unique_ptr<RawPointReader>(new RawPointReader);
-			}
-			r->open(file);
-
-			for (Point p = r->read_point(); r->has_points(); p = r->read_point()) {
-				if (i % sample_interval == 0) {
-					fwrite(&p, sizeof(struct Point), 1, sample_file);
-					sampled_points++;
+			child_point_files[index]->write(p, a);
+			num_child_points[index]++;
+			child_stats[index].add(p);
+		};
+
+		// The root is read from the inputs, all other nodes from their own point file
+		size_t num_inputs = is_input ? get_num_inputs() : 1;
+		for (size_t i = 0; i < num_inputs; i++) {
+			if (num_inputs > 1) Logger::log_info("Reading '" + std::filesystem::path(get_input_name(i)).filename().string() + "'");
+			// The root split is the only job while the inputs are read, so text is parsed by the whole pool
+			std::unique_ptr<PointReader> r = is_input ? open_input(i, pool.num_threads()) : open_raw_reader(get_full_point_file(node->id, output_path));
+
+			PointAttributes a;
+			while (r->has_points()) {
+				Point p = r->read_point(a);
+				node->stats.add(p);
+				bool sampled = sampler.add(p, a, evicted);
+
+				if (options.non_redundant) {
+					// Points that lost their place in the sample go to the children after all
+					for (auto& e : evicted) write_to_child(e.first, e.second);
+					evicted.clear();
+					if (sampled) continue;
 				}
-
-				uint8_t index = find_child_node_index(node->bounds, p);
-				if (!child_point_files[index]) {
-					child_point_files[index] = fopen(get_full_point_file(node->id + std::to_string(index), output_path).c_str(), "wb");
-					if (!child_point_files[index]) throw std::runtime_error("Could not open file");
+				else {
+					evicted.clear();
 				}
-				fwrite(&p, sizeof(struct Point), 1, child_point_files[index]);
-				num_child_points[index]++;
-				i++;
+				write_to_child(p, a);
 			}
 		}
-		fclose(sample_file);
 
-		// If this file exists (if we have not read from an las file), remove it so it can be replaced with the sampled points file
-		if(!is_las) std::filesystem::remove(get_full_point_file(node->id, output_path));
+		std::vector<Point>& samples = sampler.get_samples();
+		{
+			NodeFileWriter sample_file(get_full_temp_point_file(node->id, output_path), options.attributes);
+			sample_file.write(samples.data(), sampler.get_sample_attributes().data(), samples.size());
+		}
+		uint64_t sampled_points = samples.size();
+
+		// If this file exists (if we have not read from the input files), remove it so it can be replaced with the sampled points file
+		if(!is_input) remove_node_file(get_full_point_file(node->id, output_path), options.attributes);
 		// Replace the file that contains all points with the temp file that contains the sampled subset
-		std::filesystem::rename(get_full_temp_point_file(node->id, output_path), get_full_point_file(node->id, output_path));
+		rename_node_file(get_full_temp_point_file(node->id, output_path), get_full_point_file(node->id, output_path), options.attributes);
 		node->num_points = sampled_points;
+		if (options.non_redundant) points_processed += sampled_points;
 
 		write_node(node, false);
 
 		node->child_nodes = new Node*[8];
 		for (int i = 0; i < 8; i++) {
 			if (child_point_files[i]) {
-				fclose(child_point_files[i]);
+				child_point_files[i].reset();
 				std::string id = node->id;
 				id.append(std::to_string(i));
-				Node* child_node = create_child_node(id, num_child_points[i], std::vector<Point>(),
+				Node* child_node = create_child_node(id, num_child_points[i], PointBuffer(), AttributeColumns(),
 					node->bounds.center_x + (-(node->bounds.size / 2.0f) + ((i & (1 << 2)) ? node->bounds.size : 0)),
 					node->bounds.center_y + (-(node->bounds.size / 2.0f) + ((i & (1 << 1)) ? node->bounds.size : 0)),
 					node->bounds.center_z + (-(node->bounds.size / 2.0f) + ((i & (1 << 0)) ? node->bounds.size : 0)),
 					node->bounds.size / 2.0f);
 
+				child_node->stats = child_stats[i];
+				if (options.adaptive_split) {
+					skip_single_octant_levels(child_node);
+					if (child_node->skipped_levels) rename_node_file(get_full_point_file(id, output_path), get_full_point_file(child_node->id, output_path), options.attributes);
+				}
 				node->child_nodes_mask |= (1 << i);
 				node->child_nodes[i] = child_node;
 
@@ -270,11 +537,90 @@ void Builder::split_node(Node* node, bool is_async, bool is_las, std::vector<std
 			}
 		}
 	} else {
-		write_node(node, false);
+		if (is_input) {
+			// The whole input fits into the root node, so there is no point file to keep yet
+			node->attributes.init(options.attributes.get_strides());
+			PointAttributes a;
+			for (size_t i = 0; i < get_num_inputs(); i++) {
+				std::unique_ptr<PointReader> r = open_input(i, pool.num_threads());
+				while (r->has_points()) {
+					node->points.push_back(r->read_point(a));
+					options.attributes.append(a, node->attributes);
+				}
+			}
+			num_points_in_core += node->points.size();
+			node->stats.add(node->points.data(), node->points.size());
+			write_node(node, true);
+		}
+		else {
+			write_node(node, false);
+		}
 		points_processed += node->num_points;
 	}
 }
 
+// Filter the input points into the point file of the root node. The bounds and the
+// point count of the root are taken from the points that are kept, so the octree is
+// sized to the filtered data.
+void Builder::ingest_filtered(Node* root_node) {
+	const uint64_t batch_size = 1 << 16;
+
+	std::mutex root_file_lock;
+	std::unique_ptr<NodeFileWriter> root_file(new NodeFileWriter(get_full_point_file(root_node->id, output_path), options.attributes));
+
+	Bounds bounds;
+	uint64_t points_kept = 0;
+	std::atomic<uint64_t> points_read = 0;
+	std::vector<std::string> errors(get_num_inputs());
+
+	{
+		ThreadPool ingest_pool(pool.num_threads());
+		// The inputs that are read at once share the cores for parsing text
+		uint16_t text_threads = (uint16_t)std::max<size_t>(1, pool.num_threads() / std::max<size_t>(1, std::min<size_t>(get_num_inputs(), pool.num_threads())));
+		for (size_t i = 0; i < get_num_inputs(); i++) {
+			ingest_pool.add_job([&, i] {
+				try {
+					std::unique_ptr<PointReader> r = open_input(i, text_threads);
+					std::vector<Point> points(batch_size);
+					std::vector<PointAttributes> attributes(batch_size);
+
+					uint64_t n;
+					while ((n = r->read_batch(points.data(), attributes.data(), batch_size)) > 0) {
+						points_read += n;
+						uint64_t kept = filter->apply(points.data(), attributes.data(), n);
+
+						Bounds batch_bounds;
+						for (uint64_t j = 0; j < kept; j++) batch_bounds.add(points[j]);
+
+						std::lock_guard<std::mutex> guard(root_file_lock);
+						root_file->write(points.data(), attributes.data(), kept);
+						bounds.merge(batch_bounds);
+						points_kept += kept;
+					}
+				}
+				catch (const std::exception& exc) {
+					errors[i] = exc.what();
+				}
+			});
+		}
+		ingest_pool.wait();
+	}
+	root_file.reset();
+
+	for (size_t i = 0; i < errors.size(); i++) {
+		if (!errors[i].empty()) throw std::runtime_error(errors[i] + " (" + get_input_name(i) + ")");
+	}
+	if (points_kept == 0) throw std::runtime_error("No points left after filtering");
+
+	Logger::log_info("Kept " + std::to_string(points_kept) + " of " + std::to_string(points_read) + " points");
+
+	bounding_cube = bounds.to_cube();
+	num_points = points_kept;
+	root_node->bounds = bounding_cube;
+	root_node->num_points = num_points;
+	Logger::log_info("Filtered bounds: " + bounding_cube.to_string());
+}
+
 Node* Builder::build() {
 	Node* root_node = new Node();
 	root_node->id = "";
@@ -282,7 +628,15 @@ Node* Builder::build() {
 	root_node->child_nodes_mask = 0;
 	root_node->num_points = num_points;
 
+	// With a filter the root is split from its own point file instead of the input files
+	bool split_from_input = true;
+	if (filter && filter->is_active()) {
+		ingest_filtered(root_node);
+		split_from_input = false;
+	}
+
 	uint64_t total_points = root_node->num_points;
+	pool.reset_stats();
 	/*bool status_terminated = false;
 	std::thread status_thread([this, root_node, status_terminated] {
 		Logger::add_thread_alias("BUILD");
@@ -299,8 +653,8 @@ Node* Builder::build() {
 
 	//writer.start(output_path);
 
-	pool.add_job([this, root_node]() {split_node(root_node, true /*Don't make the root node async*/,
-		true /*The root node is directly split from the input las files*/, las_input_paths); });
+	add_job(pool, [this, root_node, split_from_input]() {split_node(root_node, true /*Don't make the root node async*/,
+		split_from_input /*The root node is directly split from the input files*/); }, get_job_priority(total_points));
 
 	/*std::chrono::milliseconds wait_span(500);
 	while (futures.size() > 0) {
@@ -316,33 +670,149 @@ Node* Builder::build() {
 	//pool.wait();
 	//writer.done();
 
-	uint64_t last_points_processed = 0;
-	while (points_processed + 1 < total_points) {
-		uint64_t throughput = points_processed - last_points_processed;
-		last_points_processed = points_processed;
-		Logger::log_return(std::to_string((int)((double)points_processed / (double)total_points * 100.0)) + "% ("
-			+ std::to_string(points_processed) + "/" + std::to_string(total_points) + ") [In-Core: "
-			+ std::to_string(num_points_in_core) + " points; Jobs: " + std::to_string(pool.num_jobs())
-			+ "; Throughput: " + std::to_string(throughput) + "P/s]                 \r");
-		std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+	try {
+		wait_for_build(total_points);
+	}
+	catch (...) {
+		delete_hierarchy(root_node);
+		throw;
 	}
-	pool.wait(); // Wait for all jobs to finish
 
 	Logger::log_info("Done building                                              ");
+	log_schedule_stats();
 
 	return root_node;
 }
 
+Node* Builder::build_subtree(const std::string& id, Cube bounds, uint64_t num_points) {
+	Node* node = new Node();
+	node->id = id;
+	node->bounds = bounds;
+	node->child_nodes_mask = 0;
+	node->num_points = num_points;
+
+	add_job(pool, [this, node]() { split_node(node, true); }, 0);
+	try {
+		wait_for_build(num_points);
+	}
+	catch (...) {
+		delete_hierarchy(node);
+		throw;
+	}
+
+	return node;
+}
+
+void Builder::build_subtrees(const std::vector<Node*>& nodes) {
+	uint64_t total_points = 0;
+	pool.reset_stats();
+	for (Node* node : nodes) {
+		total_points += node->num_points;
+		add_job(pool, [this, node]() { split_node(node, true); }, get_job_priority(node->num_points));
+	}
+	wait_for_build(total_points);
+	log_schedule_stats();
+}
+
+void Builder::sample_from_children(Node* node) {
+	node->points.clear();
+	node->attributes.init(options.attributes.get_strides());
+	for (int i = 0; i < 8; i++) {
+		if (!(node->child_nodes_mask & (1 << i))) continue;
+		Node* child = node->child_nodes[i];
+		PointBuffer points;
+		AttributeColumns attributes;
+		read_node_file(get_full_point_file(child->id, output_path), options.attributes, child->num_points, points, attributes);
+		node->points.insert(node->points.end(), points.begin(), points.end());
+		node->attributes.append(attributes);
+	}
+
+	thread_local std::vector<uint64_t> selected;
+	GridSampler::for_thread().select(node->points.data(), node->points.size(), node->bounds, sampled_node_size, selected);
+	PointBuffer sampled_points(selected.size());
+	for (uint64_t i = 0; i < selected.size(); i++) sampled_points[i] = node->points[selected[i]];
+	node->points.swap(sampled_points);
+	if (!node->attributes.empty()) {
+		AttributeColumns sampled_attributes;
+		sampled_attributes.gather(node->attributes, selected);
+		std::swap(node->attributes, sampled_attributes);
+	}
+	node->num_points = node->points.size();
+	for (int i = 0; i < 8; i++) {
+		if (node->child_nodes_mask & (1 << i)) node->stats.merge(node->child_nodes[i]->stats);
+	}
+
+	num_points_in_core += node->num_points;
+	write_node_file(node, true);
+}
+
+std::vector<Node*> Builder::get_remote_nodes() {
+	std::lock_guard<std::mutex> guard(remote_nodes_lock);
+	return remote_nodes;
+}
+
+void Builder::log_schedule_stats() {
+	// Time in which threads were idle although the build was not done, mostly the tail at the end
+	uint16_t n = pool.num_threads();
+	std::string message = "Scheduling (" + std::string(options.priority_scheduling ? "priority" : "fifo") + "): "
+		+ std::to_string((int)(pool.get_seconds_below(n) * 1000.0)) + "ms with < " + std::to_string(n) + " busy threads";
+	// Smaller thresholds are only listed if they differ from the ones before
+	if (n / 2 > 2) message += ", " + std::to_string((int)(pool.get_seconds_below(n / 2) * 1000.0)) + "ms with < " + std::to_string(n / 2);
+	if (n > 2) message += ", " + std::to_string((int)(pool.get_seconds_below(2) * 1000.0)) + "ms with < 2";
+	Logger::log_info(message);
+}
+
+void Builder::wait_for_build(uint64_t total_points) {
+	uint64_t last_points_processed = 0;
+	uint32_t ticks = 0;
+	while (points_processed < total_points && !failed) {
+		// Check often so the end of the build is noticed quickly, but only log every second
+		if (ticks++ % 20 == 0) {
+			uint64_t throughput = points_processed - last_points_processed;
+			last_points_processed = points_processed;
+			// A caller that follows the progress itself gets no progress output
+			if (options.progress) options.progress(points_processed, total_points);
+			else Logger::log_return(std::to_string((int)((double)points_processed / (double)total_points * 100.0)) + "% ("
+				+ std::to_string(points_processed) + "/" + std::to_string(total_points) + ") [In-Core: "
+				+ std::to_string(num_points_in_core) + " points; Jobs: " + std::to_string(pool.num_jobs())
+				+ "; Writes: " + std::to_string(io_pool.num_jobs())
+				+ "; Throughput: " + std::to_string(throughput) + "P/s]                 \r");
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	// Split jobs queue writes, so the writers are done once they are idle after the splits
+	pool.wait(); // Wait for all jobs to finish
+	io_pool.wait();
+	if (failed) std::rethrow_exception(build_error);
+	if (options.progress) options.progress(points_processed, total_points);
+
+	if (options.duplicate_tolerance > 0.0) {
+		Logger::log_info("Removed " + std::to_string(duplicates_removed) + " duplicate points");
+	}
+	PointBufferPool::get().log_stats();
+}
+
 Builder::Builder(Cube bounding_cube, uint64_t num_points, std::string output_path,
-	uint32_t max_node_size, uint32_t sampled_node_size, std::vector<std::string> las_input_paths) : futures(0), pool(32) {
+	uint32_t max_node_size, uint32_t sampled_node_size, std::vector<std::string> input_paths,
+	const InputManifest* manifest, IngestFilter* filter, BuildOptions options) : futures(0),
+	pool(options.compute_threads ? options.compute_threads : (uint16_t)std::min<uint32_t>(get_available_cores(), UINT16_MAX),
+		options.numa_pinning ? get_numa_thread_init() : nullptr),
+	io_pool(options.io_threads ? options.io_threads : probe_io_threads(output_path)) {
 	this->bounding_cube = bounding_cube;
 	this->num_points = num_points;
 	this->output_path = output_path;
 	this->max_node_size = max_node_size;
 	this->sampled_node_size = sampled_node_size;
 	this->points_processed = 0;
-	this->las_input_paths = las_input_paths;
+	this->num_points_in_core = 0;
+	this->duplicates_removed = 0;
+	this->failed = false;
+	this->input_paths = input_paths;
+	this->manifest = manifest;
+	this->filter = filter;
+	this->options = options;
 	octree_file = 0;
 	octree_file_cursor = 0;
 	octree_file_path = get_octree_file(output_path);
+	PointBufferPool::get().set_huge_pages(options.huge_pages);
 }
\ No newline at end of file
@@ -1,13 +1,62 @@
 #pragma once
 #include <future>
 #include <atomic>
+#include <functional>
 #include "Utils.h"
 #include "Data.h"
 #include "Logger.h"
 #include "LasPointReader.h"
+#include "LazPointReader.h"
+#include "InputManifest.h"
+#include "IngestFilter.h"
+#include "GridSampler.h"
+#include "AttributeSchema.h"
+#include "NodeFile.h"
+#include "MortonSorter.h"
 #include "RawPointReader.h"
+#include "TextPointReader.h"
+#include "MemoryPointReader.h"
 #include "PointReader.h"
 #include "ThreadPool.h"
+#include "ThreadTuning.h"
+
+// Optional build behaviour, the defaults match the original converter
+struct BuildOptions {
+	// Take sampled points out of the child nodes, so every input point is stored in exactly one node
+	bool non_redundant = false;
+	// Hand the subtrees at this depth to worker processes instead of splitting them here,
+	// 0 builds the whole octree in this process
+	uint8_t distribute_depth = 0;
+	// Start the split jobs with the most remaining work first instead of in FIFO order
+	bool priority_scheduling = true;
+	// Called about once per second while building, and once at the end
+	std::function<void(uint64_t points_processed, uint64_t total_points)> progress;
+	// Attributes that are written to column files next to every point file
+	AttributeSchema attributes;
+	// Sort the points of every node along a Morton curve before writing them
+	bool morton_order = false;
+	// With Morton order, write an index of the point ranges of the sub-blocks at this depth
+	// below each node (p<id>.index.bin), 0 writes no index
+	uint8_t morton_index_depth = 0;
+	// Remove points of leaf nodes that fall into the same cell of a grid with this spacing,
+	// only the first one is kept. 0 keeps duplicates.
+	double duplicate_tolerance = 0.0;
+	// Backing of the large point buffers of in-core nodes
+	PointBufferPool::HugePages huge_pages = PointBufferPool::HugePages::THP;
+	// Threads that split nodes and threads that write node files. 0 sizes them from the
+	// available cores and from a probe of the output storage.
+	uint16_t compute_threads = 0;
+	uint16_t io_threads = 0;
+	// Pin the split threads to the NUMA nodes round robin
+	bool numa_pinning = false;
+	// Nodes are only split in-core while the points of all in-core nodes stay below this,
+	// larger nodes are split by streaming their point files
+	uint64_t max_points_in_core = 80'000'000;
+	// Adapt the octree to the data: nodes whose points all fall into one octant skip levels,
+	// splits that would only produce undersized leaves are not done, and nodes of sparse data
+	// hold more points
+	bool adaptive_split = false;
+};
 
 class Builder {
 private:
@@ -15,15 +64,21 @@ private:
 
 	Cube bounding_cube;
 	uint64_t num_points;
-	std::vector<std::string> las_input_paths;
+	std::vector<std::string> input_paths;
+	std::vector<std::shared_ptr<const PointBatch>> input_batches;
+	const InputManifest* manifest;
+	IngestFilter* filter;
+	BuildOptions options;
 	std::string output_path;
 	uint32_t max_node_size;
 	uint32_t sampled_node_size;
 
 	std::atomic<uint64_t> points_processed;
 	std::atomic<uint64_t> num_points_in_core;
+	std::atomic<uint64_t> duplicates_removed;
 
-	ThreadPool pool;
+	ThreadPool pool; // Splitting and sampling
+	ThreadPool io_pool; // Writing node files
 
 	std::mutex octree_file_lock;
 	uint64_t octree_file_cursor;
@@ -32,21 +87,72 @@ private:
 
 	std::string octree_file_path;
 
+	std::mutex remote_nodes_lock;
+	std::vector<Node*> remote_nodes;
+
+	// First error of a split or write job, the build stops with it
+	std::mutex error_lock;
+	std::exception_ptr build_error;
+	std::atomic<bool> failed;
+
+	std::unique_ptr<PointReader> open_raw_reader(const std::string& file);
+	// Inputs are the input files followed by the batches handed over in memory
+	size_t get_num_inputs() const { return input_paths.size() + input_batches.size(); }
+	// Text inputs are parsed with text_threads threads
+	std::unique_ptr<PointReader> open_input(size_t i, uint16_t text_threads);
+	std::string get_input_name(size_t i) const;
+
 	uint8_t find_child_node_index(Cube& bounds, Point& p);
-	Node* create_child_node(std::string id, uint64_t num_points, std::vector<Point> points,
+	Node* create_child_node(std::string id, uint64_t num_points, PointBuffer&& points, AttributeColumns&& attributes,
 		float center_x, float center_y, float center_z, float size);
 
-	uint64_t ic_sample_node(Node* node);
+	uint64_t ic_sample_node(Node* node, const std::vector<uint64_t>& selected);
+	uint64_t ic_remove_duplicates(Node* node);
 	void ic_load_points(Node* node);
 	void ic_split_node(Node* node, bool is_async);
+	void ic_write_leaf(Node* node);
+
+	bool keep_as_leaf(Node* node, const uint64_t num_child_points[8]);
+	void skip_single_octant_levels(Node* node);
 
 	void split_node(Node* node, bool is_async);
-	void split_node(Node* node, bool is_async, bool is_las, std::vector<std::string> las_input_files);
+	void split_node(Node* node, bool is_async, bool is_input);
+
+	// Add a job that hands its error to the build instead of ending its thread. Jobs are
+	// skipped once the build failed, so the pools drain quickly.
+	void add_job(ThreadPool& target, std::function<void()> job, uint64_t priority);
 
 	void write_node(Node* node, bool in_core);
+	// Write the points of a node right away, write_node does this in a pool job
+	void write_node_file(Node* node, bool in_core);
+
+	void ingest_filtered(Node* root_node);
+	// Wait until all points are processed, throws the first error of a job
+	void wait_for_build(uint64_t total_points);
+
+	uint64_t get_job_priority(uint64_t num_points);
+	void log_schedule_stats();
 	
 public:
+	// Open an input file by its format. LAS headers are taken from the manifest if it has
+	// them, text files are parsed with text_threads threads (0 uses all available cores).
+	static std::unique_ptr<PointReader> open_input_reader(const std::string& file, const InputManifest* manifest, uint16_t text_threads);
+
+	// Points to read in addition to the input files, the bounding cube has to include them
+	void add_input_batch(std::shared_ptr<const PointBatch> batch);
+
 	Node* build();
+	// Build the subtree below a node whose points are in its point file
+	Node* build_subtree(const std::string& id, Cube bounds, uint64_t num_points);
+	// Build the subtrees below several nodes whose points are in their point files
+	void build_subtrees(const std::vector<Node*>& nodes);
+	// Sample the points of an inner node from the point files of its children, which
+	// have to be built already, and write them
+	void sample_from_children(Node* node);
+	// Nodes that were left to workers in a distributed build
+	std::vector<Node*> get_remote_nodes();
+
 	Builder(Cube bounding_cube, uint64_t num_points, std::string output_path,
-		uint32_t max_node_size, uint32_t sampled_node_size, std::vector<std::string> las_input_paths);
+		uint32_t max_node_size, uint32_t sampled_node_size, std::vector<std::string> input_paths,
+		const InputManifest* manifest = nullptr, IngestFilter* filter = nullptr, BuildOptions options = BuildOptions());
 };
\ No newline at end of file
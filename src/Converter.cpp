@@ -0,0 +1,87 @@
+#include "Converter.h"
+#include <filesystem>
+#include <stdexcept>
+#include "HierarchyWriter.h"
+#include "InputManifest.h"
+#include "StreamBuilder.h"
+#include "Utils.h"
+
+Converter::Converter(const std::string& output_path, ConverterOptions options) {
+	this->output_path = output_path;
+	this->options = options;
+	if (options.build.distribute_depth) throw std::runtime_error("Distributed builds are not supported by the library");
+}
+
+Converter::~Converter() {
+	if (root_node) delete_hierarchy(root_node);
+}
+
+void Converter::add_file(const std::string& path) {
+	if (get_point_file_format(path) < 0 || get_point_file_format(path) == POINT_FILE_FORMAT_RAW)
+		throw std::runtime_error("Unsupported input file '" + path + "'");
+	if (get_point_file_format(path) == POINT_FILE_FORMAT_LAZ && !LazPointReader::is_supported())
+		throw std::runtime_error("LAZ input requires building with LASzip ('" + path + "')");
+	input_files.push_back(path);
+}
+
+void Converter::add_points(const Point* points, const PointAttributes* attributes, uint64_t num_points) {
+	std::shared_ptr<PointBatch> batch = std::make_shared<PointBatch>();
+	batch->points.assign(points, points + num_points);
+	if (attributes) batch->attributes.assign(attributes, attributes + num_points);
+	add_points(batch);
+}
+
+void Converter::add_points(std::shared_ptr<const PointBatch> batch) {
+	if (!batch->attributes.empty() && batch->attributes.size() != batch->points.size())
+		throw std::runtime_error("A batch needs one set of attributes per point");
+	if (batch->points.empty()) return;
+	for (const Point& p : batch->points) batch_bounds.add(p);
+	num_batch_points += batch->points.size();
+	input_batches.push_back(batch);
+}
+
+void Converter::set_progress_callback(std::function<void(uint64_t, uint64_t)> callback) {
+	options.build.progress = callback;
+}
+
+const Node* Converter::convert() {
+	if (root_node) throw std::runtime_error("The octree was already converted");
+
+	std::filesystem::create_directories(output_path);
+	if (!is_directory_empty(output_path)) throw std::runtime_error("Output directory must be empty");
+
+	// Headers of the input files, the batches are already known. Text files have no header, unless
+	// the sampling has to be non-redundant they are streamed into a growing octree instead of
+	// being parsed once more just for their bounds.
+	InputManifest manifest;
+	manifest.scan(input_files, options.build.io_threads ? options.build.io_threads : probe_io_threads(output_path),
+		options.build.non_redundant);
+
+	if (!manifest.get_unscanned_files().empty()) {
+		StreamBuilder builder(output_path, options.max_node_size, options.sampled_node_size, options.filter, options.build);
+		for (auto& batch : input_batches) builder.add_input_batch(batch);
+		uint64_t num_points = 0;
+		root_node = builder.build(input_files, &manifest, num_points);
+	}
+	else {
+		uint64_t num_points = 0;
+		Bounds bounds = manifest.get_bounds(num_points);
+		bounds.merge(batch_bounds);
+		num_points += num_batch_points;
+		if (num_points == 0) throw std::runtime_error("No points to convert");
+
+		Builder builder(bounds.to_cube(), num_points, output_path, options.max_node_size, options.sampled_node_size,
+			input_files, &manifest, options.filter, options.build);
+		for (auto& batch : input_batches) builder.add_input_batch(batch);
+		root_node = builder.build();
+	}
+
+	if (options.write_hierarchy) {
+		write_hierarchy(root_node, output_path + "/hierarchy.bin");
+		if (!options.build.attributes.empty()) options.build.attributes.save(output_path + "/attributes.txt");
+	}
+
+	// The batches are not needed anymore
+	input_batches.clear();
+	return root_node;
+}
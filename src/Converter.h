@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "Data.h"
+#include "Builder.h"
+#include "IngestFilter.h"
+#include "MemoryPointReader.h"
+
+// Public interface of the converter library. Points are taken from files and from
+// batches in memory, the octree is written to the output directory and its hierarchy
+// is returned in memory:
+//
+//   Converter converter("out");
+//   converter.add_points(points, attributes, n);
+//   const Node* root = converter.convert();
+struct ConverterOptions {
+	uint32_t max_node_size = 15'000;
+	uint32_t sampled_node_size = 15'000;
+	BuildOptions build;
+	// Optional filter that is applied while ingesting, not owned by the converter
+	IngestFilter* filter = nullptr;
+	// Also write hierarchy.bin (and attributes.txt) to the output directory
+	bool write_hierarchy = true;
+};
+
+class Converter {
+private:
+	std::string output_path;
+	ConverterOptions options;
+	std::vector<std::string> input_files;
+	std::vector<std::shared_ptr<const PointBatch>> input_batches;
+	Bounds batch_bounds;
+	uint64_t num_batch_points = 0;
+	Node* root_node = nullptr;
+
+public:
+	Converter(const std::string& output_path, ConverterOptions options = ConverterOptions());
+	~Converter();
+
+	void add_file(const std::string& path);
+	// Copy a batch of points, attributes may be nullptr
+	void add_points(const Point* points, const PointAttributes* attributes, uint64_t num_points);
+	// Take a batch without copying it, it has to stay unchanged until convert returns
+	void add_points(std::shared_ptr<const PointBatch> batch);
+
+	// Called with the number of points processed so far and the total
+	void set_progress_callback(std::function<void(uint64_t, uint64_t)> callback);
+
+	// Build the octree from everything added so far. The hierarchy belongs to the converter.
+	const Node* convert();
+};
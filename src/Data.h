@@ -1,44 +1,192 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include "PointBufferPool.h"
 
 #define POINT_FILE_FORMAT_LAS 0
 #define POINT_FILE_FORMAT_RAW 1
 #define POINT_FILE_FORMAT_PTS 2
+#define POINT_FILE_FORMAT_LAZ 3
+
+// hierarchy.bin starts with the magic and a version, files without them are version 1,
+// which has no node statistics. Version 3 adds nodes that skip levels.
+#define HIERARCHY_MAGIC "PCCH"
+#define HIERARCHY_VERSION 3
+// The node statistics include the color range
+#define HIERARCHY_FLAG_COLORS 1
+// Every node lists the octants of the levels it skipped below the octant of its parent
+#define HIERARCHY_FLAG_SKIPPED_LEVELS 2
 
 struct Point {
 	float x, y, z;
 	uint16_t r, g, b;
 };
 
-struct Bounds {
-	float min_x = std::numeric_limits<float>::max();
-	float min_y = std::numeric_limits<float>::max();
-	float min_z = std::numeric_limits<float>::max();
-	float max_x = std::numeric_limits<float>::lowest();
-	float max_y = std::numeric_limits<float>::lowest();
-	float max_z = std::numeric_limits<float>::lowest();
+// Points of a node that is split in-core, the buffers are recycled by the point buffer pool
+typedef std::vector<Point, PointBufferAllocator<Point>> PointBuffer;
+
+// Attributes of an input point that are not stored in Point. Readers that do not
+// know an attribute leave it at zero.
+struct PointAttributes {
+	uint16_t intensity = 0;
+	uint8_t classification = 0;
+	uint8_t return_number = 0;
+	uint8_t number_of_returns = 0;
+	double gps_time = 0.0;
+};
+
+// Extra attributes of a set of points, stored column by column (one column per attribute
+// of the schema) in the same order as the points. Values are kept as raw bytes.
+struct AttributeColumns {
+	std::vector<uint32_t> strides; // Bytes per value of each column
+	std::vector<std::vector<uint8_t>> columns;
+
+	void init(const std::vector<uint32_t>& strides) {
+		this->strides = strides;
+		columns.assign(strides.size(), std::vector<uint8_t>());
+	}
+
+	bool empty() const { return columns.empty(); }
+
+	// Copy the values of the given points of src
+	void gather(const AttributeColumns& src, const std::vector<uint64_t>& indices) {
+		init(src.strides);
+		for (size_t c = 0; c < columns.size(); c++) {
+			uint32_t stride = strides[c];
+			columns[c].resize(indices.size() * stride);
+			for (size_t i = 0; i < indices.size(); i++) {
+				std::copy_n(&src.columns[c][indices[i] * stride], stride, &columns[c][i * stride]);
+			}
+		}
+	}
+
+	// Add the values of other after the values of this
+	void append(const AttributeColumns& other) {
+		for (size_t c = 0; c < columns.size(); c++) {
+			columns[c].insert(columns[c].end(), other.columns[c].begin(), other.columns[c].end());
+		}
+	}
+
+	void free() {
+		for (auto& c : columns) std::vector<uint8_t>().swap(c);
+	}
 };
 
 struct Cube {
 	float center_x, center_y, center_z;
 	// Size is half the length of one edge
 	float size;
+
+	// Cube of child i, the bits of i select the upper half along x (4), y (2) and z (1)
+	Cube get_octant(uint8_t i) const {
+		Cube c;
+		c.center_x = center_x + (-(size / 2.0f) + ((i & (1 << 2)) ? size : 0));
+		c.center_y = center_y + (-(size / 2.0f) + ((i & (1 << 1)) ? size : 0));
+		c.center_z = center_z + (-(size / 2.0f) + ((i & (1 << 0)) ? size : 0));
+		c.size = size / 2.0f;
+		return c;
+	}
 	
 	std::string to_string() {
 		return "(" + std::to_string(center_x) + ", " + std::to_string(center_y) + ", " + std::to_string(center_z) + "), " + std::to_string(size);
 	}
 };
 
+struct Bounds {
+	float min_x = std::numeric_limits<float>::max();
+	float min_y = std::numeric_limits<float>::max();
+	float min_z = std::numeric_limits<float>::max();
+	float max_x = std::numeric_limits<float>::lowest();
+	float max_y = std::numeric_limits<float>::lowest();
+	float max_z = std::numeric_limits<float>::lowest();
+
+	void add(const Point& p) {
+		if (p.x < min_x) min_x = p.x;
+		if (p.y < min_y) min_y = p.y;
+		if (p.z < min_z) min_z = p.z;
+		if (p.x > max_x) max_x = p.x;
+		if (p.y > max_y) max_y = p.y;
+		if (p.z > max_z) max_z = p.z;
+	}
+
+	void merge(const Bounds& b) {
+		if (b.min_x < min_x) min_x = b.min_x;
+		if (b.min_y < min_y) min_y = b.min_y;
+		if (b.min_z < min_z) min_z = b.min_z;
+		if (b.max_x > max_x) max_x = b.max_x;
+		if (b.max_y > max_y) max_y = b.max_y;
+		if (b.max_z > max_z) max_z = b.max_z;
+	}
+
+	Cube to_cube() const {
+		Cube c;
+		// Cast to double to avoid overflow when adding
+		c.center_x = (float)(((double)max_x + (double)min_x) / 2.0);
+		c.center_y = (float)(((double)max_y + (double)min_y) / 2.0);
+		c.center_z = (float)(((double)max_z + (double)min_z) / 2.0);
+
+		c.size = std::max(max_x - min_x, std::max(max_y - min_y, max_z - min_z));
+		return c;
+	}
+};
+
+// Statistics of a node that are stored in the hierarchy. The bounds and the color range
+// cover all points of the subtree, the spacing is the average distance between the points
+// of the node itself (the point density is 1 / spacing^2 on surfaces).
+struct NodeStats {
+	Bounds bounds;
+	float spacing = 0.0f;
+	uint16_t color_min[3] = { UINT16_MAX, UINT16_MAX, UINT16_MAX };
+	uint16_t color_max[3] = { 0, 0, 0 };
+
+	bool empty() const { return bounds.min_x > bounds.max_x; }
+
+	void add(const Point& p) {
+		bounds.add(p);
+		color_min[0] = std::min(color_min[0], p.r); color_max[0] = std::max(color_max[0], p.r);
+		color_min[1] = std::min(color_min[1], p.g); color_max[1] = std::max(color_max[1], p.g);
+		color_min[2] = std::min(color_min[2], p.b); color_max[2] = std::max(color_max[2], p.b);
+	}
+
+	void add(const Point* points, uint64_t num_points) {
+		for (uint64_t i = 0; i < num_points; i++) add(points[i]);
+	}
+
+	// Include the bounds and colors of a child, the spacing is left as it is
+	void merge(const NodeStats& other) {
+		bounds.merge(other.bounds);
+		for (int c = 0; c < 3; c++) {
+			color_min[c] = std::min(color_min[c], other.color_min[c]);
+			color_max[c] = std::max(color_max[c], other.color_max[c]);
+		}
+	}
+};
+
+// Start of hierarchy.bin, followed by the root cube and the nodes
+struct HierarchyHeader {
+	char magic[4];
+	uint16_t version;
+	uint16_t flags;
+};
+
+
 struct Node {
 	Cube bounds;
+	NodeStats stats;
 	std::string id;
 	uint64_t num_points;
-	std::vector<Point> points; // Only used when splitting points in-core
+	PointBuffer points; // Only used when splitting points in-core
+	AttributeColumns attributes; // Only used when splitting points in-core
 	uint64_t byte_index;
 	// Bit mask, the rightmost bit is the first node, the leftmost corresponds to the eighth child node
 	uint8_t child_nodes_mask;
 	uint8_t num_child_nodes;
+	// Levels between the parent and this node that were left out because all points fell into
+	// one octant. The octants are the last digits of the id, the bounds are the innermost one.
+	uint8_t skipped_levels;
 	// Indices of the nodes:
 	// (7) 00000111: right, top, back
 	// (5) 00000101: right, bottom, back
@@ -48,7 +196,7 @@ struct Node {
 	Node** child_nodes;
 
 	void free_points() {
-		std::vector<Point>().swap(points);
+		PointBuffer().swap(points);
 	}
 };
 
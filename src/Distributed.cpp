@@ -0,0 +1,169 @@
+#include "Distributed.h"
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+#include "Builder.h"
+#include "HierarchyWriter.h"
+#include "Logger.h"
+#include "Utils.h"
+
+#define WORKER_POLL_INTERVAL std::chrono::milliseconds(200)
+
+static std::string get_job_file(const std::string& output_path, const std::string& id, const std::string& state) {
+	return get_jobs_directory(output_path) + "/" + id + "." + state;
+}
+
+// Write a file under a temporary name first, so readers never see it half written
+static void write_file_atomic(const std::string& path, const std::string& content) {
+	std::string temp_path = path + ".tmp";
+	FILE* file = fopen(temp_path.c_str(), "wb");
+	if (!file) THROW_FILE_OPEN_ERROR;
+	fwrite(content.data(), 1, content.size(), file);
+	fclose(file);
+	std::filesystem::rename(temp_path, path);
+}
+
+static std::string read_file(const std::string& path) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file) THROW_FILE_OPEN_ERROR;
+	std::string content;
+	char buffer[4096];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) content.append(buffer, read);
+	fclose(file);
+	return content;
+}
+
+void write_build_config(const std::string& output_path, uint32_t max_node_size, uint32_t sampled_node_size,
+	const BuildOptions& options) {
+	std::filesystem::create_directories(get_jobs_directory(output_path));
+	write_file_atomic(get_jobs_directory(output_path) + "/build.cfg",
+		std::to_string(max_node_size) + " " + std::to_string(sampled_node_size) + " " + std::to_string(options.non_redundant)
+		+ " " + (options.attributes.empty() ? "-" : options.attributes.to_string())
+		+ " " + std::to_string(options.morton_order) + " " + std::to_string(options.morton_index_depth)
+		+ " " + std::to_string(options.duplicate_tolerance) + " " + std::to_string(options.adaptive_split)
+		+ " " + std::to_string(options.max_points_in_core) + "\n");
+}
+
+void submit_job(const std::string& output_path, const Node* node) {
+	if (node->id.empty()) throw std::runtime_error("The root node can not be distributed");
+	char line[256];
+	// 9 significant digits restore a float exactly
+	snprintf(line, sizeof(line), "%.9g %.9g %.9g %.9g %llu\n", node->bounds.center_x, node->bounds.center_y,
+		node->bounds.center_z, node->bounds.size, (unsigned long long)node->num_points);
+	write_file_atomic(get_job_file(output_path, node->id, "job"), line);
+}
+
+void finish_submitting(const std::string& output_path) {
+	write_file_atomic(get_jobs_directory(output_path) + "/submitted", "");
+}
+
+// Claim a job by renaming its file, only one worker can succeed
+static bool claim_job(const std::string& output_path, SubtreeJob& job) {
+	std::error_code ec;
+	for (auto& entry : std::filesystem::directory_iterator(get_jobs_directory(output_path), ec)) {
+		if (entry.path().extension() != ".job") continue;
+		std::string id = entry.path().stem().string();
+		std::string claimed_path = get_job_file(output_path, id, "claimed");
+
+		std::error_code rename_ec;
+		std::filesystem::rename(entry.path(), claimed_path, rename_ec);
+		if (rename_ec) continue; // Another worker was faster
+
+		std::string content = read_file(claimed_path);
+		unsigned long long num_points = 0;
+		job.id = id;
+		if (sscanf(content.c_str(), "%f %f %f %f %llu", &job.bounds.center_x, &job.bounds.center_y,
+			&job.bounds.center_z, &job.bounds.size, &num_points) != 5) {
+			throw std::runtime_error("Invalid job file for node " + id);
+		}
+		job.num_points = num_points;
+		return true;
+	}
+	return false;
+}
+
+uint64_t run_worker(const std::string& output_path, uint16_t compute_threads, uint16_t io_threads) {
+	std::string config_path = get_jobs_directory(output_path) + "/build.cfg";
+	while (!std::filesystem::exists(config_path)) std::this_thread::sleep_for(WORKER_POLL_INTERVAL);
+
+	uint32_t max_node_size, sampled_node_size;
+	int non_redundant;
+	char attributes[256];
+	int morton_order, morton_index_depth;
+	double duplicate_tolerance;
+	int adaptive_split;
+	unsigned long long max_points_in_core;
+	if (sscanf(read_file(config_path).c_str(), "%u %u %d %255s %d %d %lf %d %llu", &max_node_size, &sampled_node_size, &non_redundant,
+		attributes, &morton_order, &morton_index_depth, &duplicate_tolerance, &adaptive_split, &max_points_in_core) != 9)
+		throw std::runtime_error("Invalid build config");
+	BuildOptions options;
+	options.non_redundant = non_redundant != 0;
+	options.morton_order = morton_order != 0;
+	options.morton_index_depth = (uint8_t)morton_index_depth;
+	options.duplicate_tolerance = duplicate_tolerance;
+	options.adaptive_split = adaptive_split != 0;
+	options.max_points_in_core = max_points_in_core;
+	if (std::string(attributes) != "-") options.attributes = AttributeSchema::parse(attributes);
+	options.compute_threads = compute_threads;
+	options.io_threads = io_threads;
+
+	uint64_t jobs_built = 0;
+	while (true) {
+		SubtreeJob job;
+		if (!claim_job(output_path, job)) {
+			// Jobs are submitted while the coordinator splits, only stop once it is done
+			if (std::filesystem::exists(get_jobs_directory(output_path) + "/submitted")) break;
+			std::this_thread::sleep_for(WORKER_POLL_INTERVAL);
+			continue;
+		}
+
+		Logger::log_info("Building subtree '" + job.id + "' (" + std::to_string(job.num_points) + " points)");
+		try {
+			Builder b(job.bounds, job.num_points, output_path, max_node_size, sampled_node_size,
+				std::vector<std::string>(), nullptr, nullptr, options);
+			Node* node = b.build_subtree(job.id, job.bounds, job.num_points);
+
+			std::string done_path = get_job_file(output_path, job.id, "done");
+			write_hierarchy(node, done_path + ".tmp");
+			std::filesystem::rename(done_path + ".tmp", done_path);
+		}
+		catch (const std::exception& exc) {
+			write_file_atomic(get_job_file(output_path, job.id, "failed"), exc.what());
+		}
+		jobs_built++;
+	}
+	return jobs_built;
+}
+
+std::vector<std::future<int>> spawn_local_workers(const std::string& executable, const std::string& output_path,
+	uint32_t num_workers) {
+	std::vector<std::future<int>> workers;
+	std::string command = "\"" + executable + "\" --worker \"" + output_path + "\"";
+	for (uint32_t i = 0; i < num_workers; i++) {
+		workers.push_back(std::async(std::launch::async, [command] {
+			return std::system(command.c_str());
+		}));
+	}
+	return workers;
+}
+
+void merge_subtrees(const std::vector<Node*>& remote_nodes, const std::string& output_path) {
+	for (Node* node : remote_nodes) {
+		std::string done_path = get_job_file(output_path, node->id, "done");
+		std::string failed_path = get_job_file(output_path, node->id, "failed");
+		while (!std::filesystem::exists(done_path)) {
+			if (std::filesystem::exists(failed_path))
+				throw std::runtime_error("Subtree '" + node->id + "' failed: " + read_file(failed_path));
+			std::this_thread::sleep_for(WORKER_POLL_INTERVAL);
+		}
+
+		Node* subtree = read_hierarchy(done_path, node->id);
+		node->num_points = subtree->num_points;
+		node->stats = subtree->stats;
+		node->child_nodes_mask = subtree->child_nodes_mask;
+		node->num_child_nodes = subtree->num_child_nodes;
+		node->child_nodes = subtree->child_nodes;
+		delete subtree;
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <future>
+#include "Data.h"
+
+struct BuildOptions;
+
+// A distributed build shares the output directory between a coordinator and any number
+// of worker processes, which may run on other machines that mount the same directory.
+//
+// The coordinator splits the first levels of the octree and leaves every subtree at the
+// distribution depth as a job file in the jobs directory. The points of a job are in the
+// point file of its node. A worker claims a job by renaming the job file, builds the
+// subtree with the normal in-core/out-of-core split and writes the subtree hierarchy
+// next to it. Node ids of different subtrees never collide, so all workers write their
+// point files straight into the output directory. The coordinator then merges the
+// subtree hierarchies into its own.
+
+struct SubtreeJob {
+	std::string id;
+	Cube bounds;
+	uint64_t num_points;
+};
+
+void write_build_config(const std::string& output_path, uint32_t max_node_size, uint32_t sampled_node_size,
+	const BuildOptions& options);
+void submit_job(const std::string& output_path, const Node* node);
+// Tell the workers that no more jobs will be submitted
+void finish_submitting(const std::string& output_path);
+
+// Claim and build jobs until there are none left, returns the number of jobs built. The
+// thread counts are local to this process, 0 sizes them from this machine.
+uint64_t run_worker(const std::string& output_path, uint16_t compute_threads = 0, uint16_t io_threads = 0);
+
+// Start worker processes of this executable on this machine
+std::vector<std::future<int>> spawn_local_workers(const std::string& executable, const std::string& output_path,
+	uint32_t num_workers);
+
+// Wait until all remote nodes are built and attach their subtrees
+void merge_subtrees(const std::vector<Node*>& remote_nodes, const std::string& output_path);
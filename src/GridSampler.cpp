@@ -0,0 +1,208 @@
+#include "GridSampler.h"
+#include <cmath>
+
+// Highest grid resolution per axis, cell coordinates are packed into 21 bits each
+#define MAX_GRID_RESOLUTION (1 << 20)
+#define MAX_SELECT_ATTEMPTS 6
+// Cells per axis of the grid that estimates the spacing
+#define SPACING_GRID_RESOLUTION 32
+
+static inline uint64_t hash_key(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key;
+}
+
+void CellTable::reset(uint64_t max_entries) {
+	uint64_t capacity = 16;
+	while (capacity < max_entries * 2) capacity <<= 1;
+	if (capacity > stamps.size()) {
+		keys.assign(capacity, 0);
+		values.assign(capacity, 0);
+		stamps.assign(capacity, 0);
+		generation = 0;
+	}
+	mask = capacity - 1;
+	count = 0;
+	generation++;
+	if (generation == 0) { // Wrapped around, old stamps could look valid
+		std::fill(stamps.begin(), stamps.end(), 0);
+		generation = 1;
+	}
+}
+
+uint64_t& CellTable::insert(uint64_t key, bool& inserted) {
+	uint64_t i = hash_key(key) & mask;
+	while (stamps[i] == generation) {
+		if (keys[i] == key) {
+			inserted = false;
+			return values[i];
+		}
+		i = (i + 1) & mask;
+	}
+	stamps[i] = generation;
+	keys[i] = key;
+	count++;
+	inserted = true;
+	return values[i];
+}
+
+static inline float cell_center_distance(const Point& p, const Cube& bounds, uint32_t resolution) {
+	float cell_size = bounds.size * 2.0f / resolution;
+	float min_x = bounds.center_x - bounds.size, min_y = bounds.center_y - bounds.size, min_z = bounds.center_z - bounds.size;
+	float dx = std::fmod(p.x - min_x, cell_size) - cell_size * 0.5f;
+	float dy = std::fmod(p.y - min_y, cell_size) - cell_size * 0.5f;
+	float dz = std::fmod(p.z - min_z, cell_size) - cell_size * 0.5f;
+	return dx * dx + dy * dy + dz * dz;
+}
+
+void GridSampler::select(const Point* points, uint64_t num_points, const Cube& bounds, uint32_t target,
+	std::vector<uint64_t>& selected) {
+	selected.clear();
+	if (num_points <= target) {
+		for (uint64_t i = 0; i < num_points; i++) selected.push_back(i);
+		return;
+	}
+
+	// Point clouds are mostly surfaces, so the number of occupied cells grows with the square of the resolution
+	uint32_t resolution = std::clamp((uint32_t)std::ceil(std::sqrt((double)target)), 1u, (uint32_t)MAX_GRID_RESOLUTION);
+	uint32_t best_resolution = 1;
+	uint64_t best_count = 0;
+	// Finest resolution with more cells than the target that still stayed below max_cells
+	uint32_t fallback_resolution = 0;
+	uint64_t fallback_count = 0;
+	// Give up on a resolution early if it has far too many cells
+	const uint64_t max_cells = (uint64_t)target * 4;
+
+	for (int attempt = 0; attempt < MAX_SELECT_ATTEMPTS; attempt++) {
+		cells.reset(max_cells);
+		bool aborted = false;
+		for (uint64_t i = 0; i < num_points; i++) {
+			bool inserted;
+			cells.insert(get_cell_key(points[i], bounds, resolution), inserted);
+			if (inserted && cells.size() > max_cells) {
+				aborted = true;
+				break;
+			}
+		}
+		uint64_t count = cells.size();
+
+		if (!aborted && count <= target && count > best_count) {
+			best_count = count;
+			best_resolution = resolution;
+		}
+		if (!aborted && count > target && resolution > fallback_resolution) {
+			fallback_count = count;
+			fallback_resolution = resolution;
+		}
+		if (!aborted && count <= target && count * 10 >= (uint64_t)target * 8) break; // Close enough
+
+		uint32_t next;
+		if (aborted) next = resolution / 2;
+		else next = (uint32_t)(resolution * std::sqrt((double)target / (double)count) * 0.95);
+		next = std::clamp(next, 1u, (uint32_t)MAX_GRID_RESOLUTION);
+		if (next == resolution) break;
+		resolution = next;
+	}
+
+	// No attempt got to the target, keep the cells of the fallback up to the target instead of a single point
+	if (best_count == 0 && fallback_resolution) {
+		best_count = fallback_count;
+		best_resolution = fallback_resolution;
+	}
+
+	// Take the point closest to the center of each occupied cell
+	resolution = best_resolution;
+	cells.reset(std::max<uint64_t>(best_count, 1));
+	for (uint64_t i = 0; i < num_points; i++) {
+		bool inserted;
+		uint64_t& index = cells.insert(get_cell_key(points[i], bounds, resolution), inserted);
+		if (inserted || cell_center_distance(points[i], bounds, resolution) < cell_center_distance(points[index], bounds, resolution)) {
+			index = i;
+		}
+	}
+	selected.reserve(cells.size());
+	cells.for_each([&](uint64_t, uint64_t index) {
+		if (selected.size() < target) selected.push_back(index);
+	});
+}
+
+GridSampler& GridSampler::for_thread() {
+	thread_local GridSampler sampler;
+	return sampler;
+}
+
+float GridSampler::estimate_spacing(const Point* points, uint64_t num_points, const Cube& cube) {
+	float fallback = cube.size * 2.0f / std::sqrt((float)std::max<uint64_t>(num_points, 1));
+	if (num_points < 2) return fallback;
+	Bounds bounds;
+	for (uint64_t i = 0; i < num_points; i++) bounds.add(points[i]);
+	float extent = std::max(bounds.max_x - bounds.min_x, std::max(bounds.max_y - bounds.min_y, bounds.max_z - bounds.min_z));
+	if (extent <= 0.0f) return fallback;
+
+	const uint32_t r = SPACING_GRID_RESOLUTION;
+	float scale = r / extent;
+	std::vector<bool> occupied(r * r * r, false);
+	uint64_t num_occupied = 0;
+	for (uint64_t i = 0; i < num_points; i++) {
+		uint32_t x = std::min(r - 1, (uint32_t)((points[i].x - bounds.min_x) * scale));
+		uint32_t y = std::min(r - 1, (uint32_t)((points[i].y - bounds.min_y) * scale));
+		uint32_t z = std::min(r - 1, (uint32_t)((points[i].z - bounds.min_z) * scale));
+		uint32_t cell = (x * r + y) * r + z;
+		if (!occupied[cell]) {
+			occupied[cell] = true;
+			num_occupied++;
+		}
+	}
+	// Every occupied cell covers about one cell face of surface
+	float cell_size = extent / r;
+	return cell_size * std::sqrt((float)num_occupied / (float)num_points);
+}
+
+StreamingGridSampler::StreamingGridSampler(const Cube& bounds, uint32_t target) {
+	this->bounds = bounds;
+	this->target = std::max(1u, target);
+	// Start finer than needed, the grid is coarsened as the sample fills up
+	resolution = std::clamp((uint32_t)std::ceil(std::sqrt((double)this->target) * 4.0), 1u, (uint32_t)MAX_GRID_RESOLUTION);
+	cells.reset(this->target);
+	samples.reserve(this->target);
+	sample_attributes.reserve(this->target);
+}
+
+void StreamingGridSampler::coarsen(std::vector<std::pair<Point, PointAttributes>>& evicted) {
+	while (samples.size() >= target && resolution > 1) {
+		resolution /= 2;
+		cells.reset(target);
+		std::vector<Point> kept;
+		std::vector<PointAttributes> kept_attributes;
+		kept.reserve(target);
+		kept_attributes.reserve(target);
+		for (size_t i = 0; i < samples.size(); i++) {
+			bool inserted;
+			cells.insert(get_cell_key(samples[i], bounds, resolution), inserted);
+			if (inserted) {
+				kept.push_back(samples[i]);
+				kept_attributes.push_back(sample_attributes[i]);
+			}
+			else evicted.emplace_back(samples[i], sample_attributes[i]);
+		}
+		samples.swap(kept);
+		sample_attributes.swap(kept_attributes);
+	}
+}
+
+bool StreamingGridSampler::add(const Point& p, const PointAttributes& a, std::vector<std::pair<Point, PointAttributes>>& evicted) {
+	bool inserted;
+	cells.insert(get_cell_key(p, bounds, resolution), inserted);
+	if (!inserted) return false;
+
+	if (samples.size() >= target) {
+		// Only possible at a resolution of one
+		return false;
+	}
+	samples.push_back(p);
+	sample_attributes.push_back(a);
+	if (samples.size() >= target) coarsen(evicted);
+	return true;
+}
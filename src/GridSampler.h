@@ -0,0 +1,90 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include "Data.h"
+
+// Open addressing hash map from grid cells to a value. It is meant to be reused for
+// many nodes: entries are stamped with a generation, so clearing it is O(1).
+class CellTable {
+private:
+	std::vector<uint64_t> keys;
+	std::vector<uint64_t> values;
+	std::vector<uint32_t> stamps;
+	uint32_t generation = 0;
+	uint64_t mask = 0;
+	uint64_t count = 0;
+
+public:
+	// Clear the table and make room for at least max_entries entries
+	void reset(uint64_t max_entries);
+	// Returns the value slot of the key, inserted is set if the key was not in the table
+	uint64_t& insert(uint64_t key, bool& inserted);
+	uint64_t size() const { return count; }
+
+	template<typename F>
+	void for_each(F f) const {
+		for (uint64_t i = 0; i < stamps.size(); i++) {
+			if (stamps[i] == generation) f(keys[i], values[i]);
+		}
+	}
+};
+
+// Selects a spatially uniform subset of a node's points for level of detail. The node
+// cube is divided into a grid and at most one point per occupied cell is taken, the one
+// closest to the cell center. The grid resolution is adjusted until the number of
+// occupied cells fits the target.
+class GridSampler {
+private:
+	CellTable cells;
+
+public:
+	// Write the indices of the selected points (at most target) to selected
+	void select(const Point* points, uint64_t num_points, const Cube& bounds, uint32_t target,
+		std::vector<uint64_t>& selected);
+
+	// Sampler with scratch space owned by the calling thread
+	static GridSampler& for_thread();
+
+	// Average distance between neighboring points, assuming they sample surfaces. The
+	// occupied cells of a coarse grid over the points approximate the covered area. Points
+	// without extent (a single one or duplicates) are assumed to cover the cube of their node.
+	static float estimate_spacing(const Point* points, uint64_t num_points, const Cube& cube);
+};
+
+// Grid sampler for points that are streamed from files. It starts with a fine grid and
+// whenever the sample would exceed the target, the grid is coarsened and the samples
+// that share a coarse cell are evicted. Only the sample is kept in memory.
+class StreamingGridSampler {
+private:
+	CellTable cells;
+	Cube bounds;
+	uint32_t target;
+	uint32_t resolution;
+	std::vector<Point> samples;
+	std::vector<PointAttributes> sample_attributes;
+
+	void coarsen(std::vector<std::pair<Point, PointAttributes>>& evicted);
+
+public:
+	StreamingGridSampler(const Cube& bounds, uint32_t target);
+
+	// Returns true if the point was taken into the sample. Points that were in the
+	// sample before but had to make room are appended to evicted.
+	bool add(const Point& p, const PointAttributes& a, std::vector<std::pair<Point, PointAttributes>>& evicted);
+
+	std::vector<Point>& get_samples() { return samples; }
+	// Attributes of the samples, in the same order
+	std::vector<PointAttributes>& get_sample_attributes() { return sample_attributes; }
+};
+
+// Grid cell of a point with the given resolution per axis
+inline uint64_t get_cell_key(const Point& p, const Cube& bounds, uint32_t resolution) {
+	float edge = bounds.size * 2.0f;
+	float scale = edge > 0.0f ? resolution / edge : 0.0f;
+	int64_t last = (int64_t)resolution - 1;
+	int64_t x = std::clamp((int64_t)((p.x - (bounds.center_x - bounds.size)) * scale), (int64_t)0, last);
+	int64_t y = std::clamp((int64_t)((p.y - (bounds.center_y - bounds.size)) * scale), (int64_t)0, last);
+	int64_t z = std::clamp((int64_t)((p.z - (bounds.center_z - bounds.size)) * scale), (int64_t)0, last);
+	return ((uint64_t)x << 42) | ((uint64_t)y << 21) | (uint64_t)z;
+}
@@ -1,27 +1,143 @@
 #pragma once
 #include <stdexcept>
+#include <cstring>
 #include "Data.h"
 
-void write_node_hierarchy(Node* node, FILE* file, bool write_bounds) {
+// hierarchy.bin: a HierarchyHeader, the root cube and then every node depth first with its
+// point count and child mask, with HIERARCHY_FLAG_SKIPPED_LEVELS the number of skipped levels
+// and their octants (one byte each), then its tight bounds and spacing and with
+// HIERARCHY_FLAG_COLORS its color range
+inline void write_node_hierarchy(Node* node, FILE* file, bool write_bounds, uint16_t flags) {
 	if (write_bounds) {
 		fwrite(&node->bounds, sizeof(node->bounds), 1, file);
 	}
 	fwrite(&node->num_points, sizeof(node->num_points), 1, file);
 	fwrite(&node->child_nodes_mask, sizeof(node->child_nodes_mask), 1, file);
+	if (flags & HIERARCHY_FLAG_SKIPPED_LEVELS) {
+		fwrite(&node->skipped_levels, sizeof(node->skipped_levels), 1, file);
+		for (size_t i = node->id.size() - node->skipped_levels; i < node->id.size(); i++) {
+			uint8_t octant = (uint8_t)(node->id[i] - '0');
+			fwrite(&octant, sizeof(octant), 1, file);
+		}
+	}
+	fwrite(&node->stats.bounds, sizeof(node->stats.bounds), 1, file);
+	fwrite(&node->stats.spacing, sizeof(node->stats.spacing), 1, file);
+	if (flags & HIERARCHY_FLAG_COLORS) {
+		fwrite(node->stats.color_min, sizeof(node->stats.color_min), 1, file);
+		fwrite(node->stats.color_max, sizeof(node->stats.color_max), 1, file);
+	}
 
 	for (int i = 0; i < 8; i++) {
 		if (node->child_nodes_mask & (1 << i)) {
-			write_node_hierarchy(node->child_nodes[i], file, false);
+			write_node_hierarchy(node->child_nodes[i], file, false, flags);
 		}
 	}
 }
 
-void write_hierarchy(Node* root_node, const std::string& path) {
+inline bool has_skipped_levels(Node* node) {
+	if (node->skipped_levels) return true;
+	for (int i = 0; i < 8; i++) {
+		if ((node->child_nodes_mask & (1 << i)) && has_skipped_levels(node->child_nodes[i])) return true;
+	}
+	return false;
+}
+
+inline void write_hierarchy(Node* root_node, const std::string& path) {
 	FILE* hierarchy_file = fopen(path.c_str(), "wb");
 
 	if (!hierarchy_file) throw std::runtime_error("Could not open hierarchy file");
 
-	write_node_hierarchy(root_node, hierarchy_file, true);
+	// Inputs without colors have all colors at 0, their range is left out
+	HierarchyHeader header = { { 'P', 'C', 'C', 'H' }, HIERARCHY_VERSION, 0 };
+	const uint16_t* color_max = root_node->stats.color_max;
+	if (color_max[0] || color_max[1] || color_max[2]) header.flags |= HIERARCHY_FLAG_COLORS;
+	if (has_skipped_levels(root_node)) header.flags |= HIERARCHY_FLAG_SKIPPED_LEVELS;
+	fwrite(&header, sizeof(header), 1, hierarchy_file);
+
+	write_node_hierarchy(root_node, hierarchy_file, true, header.flags);
+
+	fclose(hierarchy_file);
+}
+
+// Read a hierarchy written by write_node_hierarchy into node. The ids and bounds of the
+// child nodes are derived from the id and bounds of node and their skipped levels.
+inline void read_node_hierarchy(Node* node, FILE* file, bool read_bounds, const HierarchyHeader& header) {
+	if (read_bounds && !fread(&node->bounds, sizeof(node->bounds), 1, file))
+		throw std::runtime_error("Unexpected end of hierarchy file");
+	if (!fread(&node->num_points, sizeof(node->num_points), 1, file)
+		|| !fread(&node->child_nodes_mask, sizeof(node->child_nodes_mask), 1, file))
+		throw std::runtime_error("Unexpected end of hierarchy file");
+	if (header.flags & HIERARCHY_FLAG_SKIPPED_LEVELS) {
+		if (!fread(&node->skipped_levels, sizeof(node->skipped_levels), 1, file))
+			throw std::runtime_error("Unexpected end of hierarchy file");
+		for (uint8_t i = 0; i < node->skipped_levels; i++) {
+			uint8_t octant;
+			if (!fread(&octant, sizeof(octant), 1, file) || octant > 7) throw std::runtime_error("Invalid hierarchy file");
+			node->bounds = node->bounds.get_octant(octant);
+			node->id += std::to_string(octant);
+		}
+	}
+	if (header.version >= 2) {
+		if (!fread(&node->stats.bounds, sizeof(node->stats.bounds), 1, file)
+			|| !fread(&node->stats.spacing, sizeof(node->stats.spacing), 1, file))
+			throw std::runtime_error("Unexpected end of hierarchy file");
+		if ((header.flags & HIERARCHY_FLAG_COLORS) && (!fread(node->stats.color_min, sizeof(node->stats.color_min), 1, file)
+			|| !fread(node->stats.color_max, sizeof(node->stats.color_max), 1, file)))
+			throw std::runtime_error("Unexpected end of hierarchy file");
+	}
+
+	node->num_child_nodes = 0;
+	if (!node->child_nodes_mask) return;
+
+	node->child_nodes = new Node*[8];
+	for (int i = 0; i < 8; i++) {
+		if (!(node->child_nodes_mask & (1 << i))) continue;
+		Node* child = new Node();
+		child->id = node->id + std::to_string(i);
+		child->bounds = node->bounds.get_octant(i);
+		read_node_hierarchy(child, file, false, header);
+		node->child_nodes[i] = child;
+		node->num_child_nodes++;
+	}
+}
+
+inline Node* read_hierarchy(const std::string& path, const std::string& root_id = "") {
+	FILE* hierarchy_file = fopen(path.c_str(), "rb");
+
+	if (!hierarchy_file) throw std::runtime_error("Could not open hierarchy file");
+
+	// Files without a header are version 1
+	HierarchyHeader header;
+	if (fread(&header, sizeof(header), 1, hierarchy_file) != 1 || memcmp(header.magic, HIERARCHY_MAGIC, 4) != 0) {
+		header = { { 0, 0, 0, 0 }, 1, 0 };
+		fseek(hierarchy_file, 0, SEEK_SET);
+	}
+	if (header.version > HIERARCHY_VERSION) {
+		fclose(hierarchy_file);
+		throw std::runtime_error("Unsupported hierarchy version " + std::to_string(header.version));
+	}
+
+	Node* root_node = new Node();
+	root_node->id = root_id;
+	try {
+		read_node_hierarchy(root_node, hierarchy_file, true, header);
+	}
+	catch (...) {
+		fclose(hierarchy_file);
+		throw;
+	}
 
 	fclose(hierarchy_file);
-}
\ No newline at end of file
+	return root_node;
+}
+
+// Free a hierarchy that was built or read, including all child nodes
+inline void delete_hierarchy(Node* node) {
+	if (node->child_nodes_mask) {
+		for (int i = 0; i < 8; i++) {
+			if (node->child_nodes_mask & (1 << i)) delete_hierarchy(node->child_nodes[i]);
+		}
+		delete[] node->child_nodes;
+	}
+	delete node;
+}
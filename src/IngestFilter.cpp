@@ -0,0 +1,135 @@
+#include "IngestFilter.h"
+#include <cmath>
+#include <stdexcept>
+
+void IngestFilter::set_crop_box(const Bounds& box) {
+	this->box = box;
+	use_box = true;
+}
+
+void IngestFilter::set_crop_polygon(const std::vector<double>& x, const std::vector<double>& y) {
+	if (x.size() != y.size() || x.size() < 3) throw std::runtime_error("A crop polygon needs at least three vertices");
+	polygon_x = x;
+	polygon_y = y;
+	polygon_bounds = Bounds();
+	for (size_t i = 0; i < x.size(); i++) {
+		polygon_bounds.add({ (float)x[i], (float)y[i], 0.0f, 0, 0, 0 });
+	}
+}
+
+void IngestFilter::set_classes(const std::vector<uint8_t>& classes) {
+	for (int i = 0; i < 8; i++) class_mask[i] = 0;
+	for (uint8_t c : classes) class_mask[c >> 5] |= 1u << (c & 31);
+	use_classes = true;
+}
+
+void IngestFilter::set_return_filter(ReturnFilter filter, uint8_t number) {
+	return_filter = filter;
+	return_number = number;
+}
+
+void IngestFilter::set_voxel_size(double size) {
+	if (size < 0.0) throw std::runtime_error("Voxel size must not be negative");
+	voxel_size = size;
+}
+
+bool IngestFilter::is_active() const {
+	return use_box || !polygon_x.empty() || use_classes || return_filter != ReturnFilter::ALL || voxel_size > 0.0;
+}
+
+bool IngestFilter::inside_polygon(double x, double y) const {
+	// Crossing number test
+	bool inside = false;
+	size_t n = polygon_x.size();
+	for (size_t i = 0, j = n - 1; i < n; j = i++) {
+		if ((polygon_y[i] > y) != (polygon_y[j] > y)
+			&& x < (polygon_x[j] - polygon_x[i]) * (y - polygon_y[i]) / (polygon_y[j] - polygon_y[i]) + polygon_x[i]) {
+			inside = !inside;
+		}
+	}
+	return inside;
+}
+
+uint64_t IngestFilter::apply(Point* points, PointAttributes* attributes, uint64_t num_points) {
+	if (!is_active()) return num_points;
+
+	std::vector<uint8_t> keep(num_points, 1);
+
+	if (use_box) {
+		for (uint64_t i = 0; i < num_points; i++) {
+			const Point& p = points[i];
+			keep[i] &= (p.x >= box.min_x) & (p.x <= box.max_x) & (p.y >= box.min_y) & (p.y <= box.max_y)
+				& (p.z >= box.min_z) & (p.z <= box.max_z);
+		}
+	}
+
+	if (use_classes) {
+		for (uint64_t i = 0; i < num_points; i++) {
+			uint8_t c = attributes[i].classification;
+			keep[i] &= (class_mask[c >> 5] >> (c & 31)) & 1;
+		}
+	}
+
+	switch (return_filter) {
+	case ReturnFilter::FIRST:
+		for (uint64_t i = 0; i < num_points; i++) keep[i] &= attributes[i].return_number <= 1;
+		break;
+	case ReturnFilter::LAST:
+		for (uint64_t i = 0; i < num_points; i++) keep[i] &= attributes[i].return_number == attributes[i].number_of_returns;
+		break;
+	case ReturnFilter::SINGLE:
+		for (uint64_t i = 0; i < num_points; i++) keep[i] &= attributes[i].number_of_returns <= 1;
+		break;
+	case ReturnFilter::NUMBER:
+		for (uint64_t i = 0; i < num_points; i++) keep[i] &= attributes[i].return_number == return_number;
+		break;
+	default:
+		break;
+	}
+
+	if (!polygon_x.empty()) {
+		for (uint64_t i = 0; i < num_points; i++) {
+			if (!keep[i]) continue;
+			const Point& p = points[i];
+			// Most points are rejected by the bounding box of the polygon
+			if (p.x < polygon_bounds.min_x || p.x > polygon_bounds.max_x
+				|| p.y < polygon_bounds.min_y || p.y > polygon_bounds.max_y) {
+				keep[i] = 0;
+				continue;
+			}
+			keep[i] = inside_polygon(p.x, p.y);
+		}
+	}
+
+	if (voxel_size > 0.0) {
+		// Group the points by shard so each shard is only locked once per batch
+		std::vector<std::pair<VoxelKey, uint64_t>> by_shard[NUM_VOXEL_SHARDS];
+		VoxelKeyHash hash;
+		for (uint64_t i = 0; i < num_points; i++) {
+			if (!keep[i]) continue;
+			VoxelKey key = {
+				(int32_t)std::floor(points[i].x / voxel_size),
+				(int32_t)std::floor(points[i].y / voxel_size),
+				(int32_t)std::floor(points[i].z / voxel_size)
+			};
+			by_shard[hash(key) % NUM_VOXEL_SHARDS].push_back({ key, i });
+		}
+		for (int s = 0; s < NUM_VOXEL_SHARDS; s++) {
+			if (by_shard[s].empty()) continue;
+			std::lock_guard<std::mutex> guard(voxel_locks[s]);
+			for (auto& entry : by_shard[s]) {
+				keep[entry.second] = voxels[s].insert(entry.first).second;
+			}
+		}
+	}
+
+	// Compact the batch
+	uint64_t kept = 0;
+	for (uint64_t i = 0; i < num_points; i++) {
+		if (!keep[i]) continue;
+		points[kept] = points[i];
+		attributes[kept] = attributes[i];
+		kept++;
+	}
+	return kept;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <unordered_set>
+#include "Data.h"
+
+// Decides which input points enter the octree. Every criterion is optional, a point
+// is kept if it passes all criteria that are set. Batches are filtered one criterion
+// at a time so that each pass is a tight loop over the batch.
+class IngestFilter {
+public:
+	enum class ReturnFilter {
+		ALL,
+		FIRST,
+		LAST,
+		SINGLE,
+		NUMBER, // Only points with the given return number
+	};
+
+private:
+	struct VoxelKey {
+		int32_t x, y, z;
+		bool operator==(const VoxelKey& other) const { return x == other.x && y == other.y && z == other.z; }
+	};
+	struct VoxelKeyHash {
+		size_t operator()(const VoxelKey& k) const {
+			return ((size_t)k.x * 73856093) ^ ((size_t)k.y * 19349663) ^ ((size_t)k.z * 83492791);
+		}
+	};
+
+	static const int NUM_VOXEL_SHARDS = 64;
+
+	bool use_box = false;
+	Bounds box;
+
+	std::vector<double> polygon_x, polygon_y;
+	Bounds polygon_bounds;
+
+	bool use_classes = false;
+	uint32_t class_mask[8] = { 0 };
+
+	ReturnFilter return_filter = ReturnFilter::ALL;
+	uint8_t return_number = 0;
+
+	double voxel_size = 0.0;
+	// The occupied voxels are shared between all threads, sharded to keep lock contention low
+	std::mutex voxel_locks[NUM_VOXEL_SHARDS];
+	std::unordered_set<VoxelKey, VoxelKeyHash> voxels[NUM_VOXEL_SHARDS];
+
+	bool inside_polygon(double x, double y) const;
+
+public:
+	void set_crop_box(const Bounds& box);
+	// Crop to a polygon in the xy plane
+	void set_crop_polygon(const std::vector<double>& x, const std::vector<double>& y);
+	void set_classes(const std::vector<uint8_t>& classes);
+	void set_return_filter(ReturnFilter filter, uint8_t number = 0);
+	// Keep only the first point that falls into each voxel of the given edge length
+	void set_voxel_size(double size);
+
+	bool is_active() const;
+
+	// Remove all points that do not pass from the batch, keeping the order of the rest.
+	// Returns the number of points kept. Can be called from multiple threads.
+	uint64_t apply(Point* points, PointAttributes* attributes, uint64_t num_points);
+};
@@ -0,0 +1,227 @@
+#include "InputManifest.h"
+#include <filesystem>
+#include <stdexcept>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include "ThreadPool.h"
+#include "Logger.h"
+#include "Utils.h"
+#include "TextPointReader.h"
+#include "LazPointReader.h"
+#include "ThreadTuning.h"
+
+#define MANIFEST_MAGIC "PCCM"
+#define MANIFEST_VERSION 2
+
+static bool stat_file(const std::string& path, uint64_t& size, int64_t& mtime) {
+	std::error_code ec;
+	size = std::filesystem::file_size(path, ec);
+	if (ec) return false;
+	auto time = std::filesystem::last_write_time(path, ec);
+	if (ec) return false;
+	mtime = (int64_t)time.time_since_epoch().count();
+	return true;
+}
+
+bool InputManifest::load(const std::string& path) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file) return false;
+
+	char magic[4];
+	uint32_t version = 0;
+	uint64_t num_entries = 0;
+	if (fread(magic, 1, 4, file) != 4 || memcmp(magic, MANIFEST_MAGIC, 4) != 0
+		|| !fread(&version, sizeof(version), 1, file) || version != MANIFEST_VERSION
+		|| !fread(&num_entries, sizeof(num_entries), 1, file)) {
+		fclose(file);
+		return false;
+	}
+
+	std::vector<ManifestEntry> loaded(num_entries);
+	for (ManifestEntry& e : loaded) {
+		uint32_t path_length = 0;
+		if (!fread(&path_length, sizeof(path_length), 1, file)) break;
+		e.path.resize(path_length);
+		fread(&e.path[0], 1, path_length, file);
+		fread(&e.file_size, sizeof(e.file_size), 1, file);
+		fread(&e.mtime, sizeof(e.mtime), 1, file);
+		fread(&e.file_format, sizeof(e.file_format), 1, file);
+		if (!fread(&e.header, sizeof(e.header), 1, file)) {
+			fclose(file);
+			return false;
+		}
+	}
+	fclose(file);
+
+	entries.swap(loaded);
+	index.clear();
+	for (size_t i = 0; i < entries.size(); i++) {
+		index[entries[i].path] = i;
+	}
+	return true;
+}
+
+void InputManifest::save(const std::string& path) {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file) throw std::runtime_error("Could not open manifest file");
+
+	uint32_t version = MANIFEST_VERSION;
+	uint64_t num_entries = entries.size();
+	fwrite(MANIFEST_MAGIC, 1, 4, file);
+	fwrite(&version, sizeof(version), 1, file);
+	fwrite(&num_entries, sizeof(num_entries), 1, file);
+
+	for (const ManifestEntry& e : entries) {
+		uint32_t path_length = (uint32_t)e.path.size();
+		fwrite(&path_length, sizeof(path_length), 1, file);
+		fwrite(e.path.data(), 1, path_length, file);
+		fwrite(&e.file_size, sizeof(e.file_size), 1, file);
+		fwrite(&e.mtime, sizeof(e.mtime), 1, file);
+		fwrite(&e.file_format, sizeof(e.file_format), 1, file);
+		fwrite(&e.header, sizeof(e.header), 1, file);
+	}
+	fclose(file);
+}
+
+void InputManifest::scan(const std::vector<std::string>& input_files, uint16_t num_threads, bool scan_text_files) {
+	std::vector<ManifestEntry> scanned(input_files.size());
+	std::vector<std::string> errors(input_files.size());
+	std::vector<uint8_t> skipped(input_files.size(), 0);
+	std::atomic<uint64_t> rescanned = 0;
+
+	{
+		ThreadPool pool(num_threads);
+		// Hand out the files in blocks, a job per file would mostly measure the queue
+		const size_t block_size = 64;
+		// Text files are parsed in parallel as well, the cores are shared by the jobs that run at once
+		size_t num_jobs = std::min<size_t>(num_threads, (input_files.size() + block_size - 1) / block_size);
+		unsigned int text_threads = std::max<unsigned int>(1, get_available_cores() / (unsigned int)std::max<size_t>(num_jobs, 1));
+		for (size_t start = 0; start < input_files.size(); start += block_size) {
+			pool.add_job([&, start] {
+				size_t end = std::min(start + block_size, input_files.size());
+				for (size_t i = start; i < end; i++) {
+					ManifestEntry& e = scanned[i];
+					e.path = input_files[i];
+					e.file_format = (uint8_t)get_point_file_format(e.path);
+					if (e.file_format == POINT_FILE_FORMAT_LAZ && !LazPointReader::is_supported()) {
+						errors[i] = "LAZ input requires building with LASzip";
+						continue;
+					}
+					if (!stat_file(e.path, e.file_size, e.mtime)) {
+						errors[i] = "Could not open file";
+						continue;
+					}
+
+					const ManifestEntry* cached = nullptr;
+					auto it = index.find(e.path);
+					if (it != index.end()) cached = &entries[it->second];
+
+					if (cached && cached->file_size == e.file_size && cached->mtime == e.mtime) {
+						e.header = cached->header;
+						continue;
+					}
+
+					if (e.file_format == POINT_FILE_FORMAT_PTS) {
+						if (!scan_text_files) {
+							skipped[i] = 1;
+							continue;
+						}
+						// Text files have no header, the whole file has to be parsed once
+						try {
+							Bounds b;
+							e.header = LasHeader();
+							TextPointReader::scan(e.path, e.header.num_points, b, text_threads);
+							e.header.min_x = b.min_x; e.header.min_y = b.min_y; e.header.min_z = b.min_z;
+							e.header.max_x = b.max_x; e.header.max_y = b.max_y; e.header.max_z = b.max_z;
+							rescanned++;
+						}
+						catch (const std::exception& exc) {
+							errors[i] = exc.what();
+						}
+						continue;
+					}
+
+					FILE* file = fopen(e.path.c_str(), "rb");
+					if (!file) {
+						errors[i] = "Could not open file";
+						continue;
+					}
+					try {
+						e.header = LasPointReader::read_header(file);
+						rescanned++;
+					}
+					catch (const std::exception& exc) {
+						errors[i] = exc.what();
+					}
+					fclose(file);
+				}
+			});
+		}
+		pool.wait();
+	}
+
+	for (size_t i = 0; i < errors.size(); i++) {
+		if (!errors[i].empty()) throw std::runtime_error(errors[i] + " (" + input_files[i] + ")");
+	}
+
+	entries.clear();
+	unscanned_files.clear();
+	for (size_t i = 0; i < scanned.size(); i++) {
+		if (skipped[i]) unscanned_files.push_back(input_files[i]);
+		else entries.push_back(std::move(scanned[i]));
+	}
+	index.clear();
+	for (size_t i = 0; i < entries.size(); i++) {
+		index[entries[i].path] = i;
+	}
+	num_scanned = rescanned;
+}
+
+void InputManifest::add_scanned(const std::string& path, uint64_t num_points, const Bounds& bounds) {
+	ManifestEntry e;
+	e.path = path;
+	e.file_format = (uint8_t)get_point_file_format(path);
+	if (!stat_file(path, e.file_size, e.mtime)) return;
+	e.header = LasHeader();
+	e.header.num_points = num_points;
+	e.header.min_x = bounds.min_x; e.header.min_y = bounds.min_y; e.header.min_z = bounds.min_z;
+	e.header.max_x = bounds.max_x; e.header.max_y = bounds.max_y; e.header.max_z = bounds.max_z;
+
+	auto it = index.find(path);
+	if (it != index.end()) {
+		entries[it->second] = e;
+	}
+	else {
+		index[path] = entries.size();
+		entries.push_back(e);
+	}
+	unscanned_files.erase(std::remove(unscanned_files.begin(), unscanned_files.end(), path), unscanned_files.end());
+	num_scanned++;
+}
+
+const LasHeader* InputManifest::find(const std::string& path) const {
+	auto it = index.find(path);
+	if (it == index.end()) return nullptr;
+	return &entries[it->second].header;
+}
+
+Cube InputManifest::get_bounding_cube(uint64_t& total_points) const {
+	return get_bounds(total_points).to_cube();
+}
+
+Bounds InputManifest::get_bounds(uint64_t& total_points) const {
+	Bounds g_bounds;
+	for (const ManifestEntry& e : entries) {
+		const LasHeader& h = e.header;
+		total_points += h.num_points;
+		if (h.max_x > g_bounds.max_x) g_bounds.max_x = (float)h.max_x;
+		if (h.max_y > g_bounds.max_y) g_bounds.max_y = (float)h.max_y;
+		if (h.max_z > g_bounds.max_z) g_bounds.max_z = (float)h.max_z;
+
+		if (h.min_x < g_bounds.min_x) g_bounds.min_x = (float)h.min_x;
+		if (h.min_y < g_bounds.min_y) g_bounds.min_y = (float)h.min_y;
+		if (h.min_z < g_bounds.min_z) g_bounds.min_z = (float)h.min_z;
+	}
+	return g_bounds;
+}
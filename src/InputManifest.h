@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Data.h"
+#include "LasPointReader.h"
+
+// Cached header of one input file. An entry is only valid as long as the size and
+// modification time of the file match.
+struct ManifestEntry {
+	std::string path;
+	uint64_t file_size;
+	int64_t mtime;
+	uint8_t file_format;
+	// For text files only the point count and bounds are set
+	LasHeader header;
+};
+
+// Caches the headers of all input files so that they only have to be opened once.
+// The manifest is written next to the input and reused on later runs.
+class InputManifest {
+private:
+	std::vector<ManifestEntry> entries;
+	std::unordered_map<std::string, size_t> index;
+
+	uint64_t num_scanned = 0;
+	std::vector<std::string> unscanned_files;
+
+public:
+	bool load(const std::string& path);
+	void save(const std::string& path);
+
+	// Read the headers of all input files in parallel, reusing entries that are still valid.
+	// Text files have no header and are parsed in full, unless scan_text_files is false: then
+	// new text files get no entry and are listed by get_unscanned_files.
+	void scan(const std::vector<std::string>& input_files, uint16_t num_threads, bool scan_text_files = true);
+	// Enter the point count and bounds of a text file that was read in full while building
+	void add_scanned(const std::string& path, uint64_t num_points, const Bounds& bounds);
+
+	const LasHeader* find(const std::string& path) const;
+	Cube get_bounding_cube(uint64_t& total_points) const;
+	Bounds get_bounds(uint64_t& total_points) const;
+
+	uint64_t get_num_scanned() const { return num_scanned; }
+	const std::vector<std::string>& get_unscanned_files() const { return unscanned_files; }
+	size_t size() const { return entries.size(); }
+};
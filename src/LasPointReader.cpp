@@ -1,82 +1,134 @@
 #include "LasPointReader.h"
 #include <stdexcept>
+#include <cstring>
+#include <algorithm>
 
-void LasPointReader::open(std::string filename) {
-	file = fopen(filename.c_str(), "rb");
-	if (!file) throw std::runtime_error("Could not open file");
+LasHeader LasPointReader::read_header(FILE* file) {
+	LasHeader h;
+
+	char signature[4];
+	if (fread(signature, 1, 4, file) != 4 || memcmp(signature, "LASF", 4) != 0)
+		throw std::runtime_error("Not a LAS file");
 
-	// Read header
 	fseek(file, 96, SEEK_SET);
-	fread(&first_point_offset, sizeof(uint32_t), 1, file);
+	fread(&h.first_point_offset, sizeof(uint32_t), 1, file);
 
-	fseek(file, 5, SEEK_CUR);
-	fread(&skip_bytes, sizeof(uint16_t), 1, file);
-	skip_bytes -= 12; // Subtract size of coordinates
+	fseek(file, 104, SEEK_SET);
+	fread(&h.point_format, sizeof(uint8_t), 1, file);
+	fread(&h.point_record_length, sizeof(uint16_t), 1, file);
 
 	uint32_t legacy_num_points = 0;
 	fread(&legacy_num_points, sizeof(uint32_t), 1, file);
 	if (legacy_num_points == 0) { // This file uses the 64 bit num_points
-		fseek(file, 140, SEEK_SET);
-		fread(&num_points, sizeof(uint64_t), 1, file);
+		fseek(file, 247, SEEK_SET);
+		h.num_points = 0;
+		fread(&h.num_points, sizeof(uint64_t), 1, file);
 	}
 	else {
-		num_points = legacy_num_points;
+		h.num_points = legacy_num_points;
 	}
 
-	fseek(file, 104, SEEK_SET);
-	fread(&point_format, sizeof(uint8_t), 1, file);
-
 	fseek(file, 131, SEEK_SET);
-	fread(&scale_x, sizeof(double), 1, file);
-	fread(&scale_y, sizeof(double), 1, file);
-	fread(&scale_z, sizeof(double), 1, file);
+	fread(&h.scale_x, sizeof(double), 1, file);
+	fread(&h.scale_y, sizeof(double), 1, file);
+	fread(&h.scale_z, sizeof(double), 1, file);
+
+	fread(&h.offset_x, sizeof(double), 1, file);
+	fread(&h.offset_y, sizeof(double), 1, file);
+	fread(&h.offset_z, sizeof(double), 1, file);
+
+	fread(&h.max_x, sizeof(double), 1, file);
+	fread(&h.min_x, sizeof(double), 1, file);
+	fread(&h.max_y, sizeof(double), 1, file);
+	fread(&h.min_y, sizeof(double), 1, file);
+	fread(&h.max_z, sizeof(double), 1, file);
+	if (!fread(&h.min_z, sizeof(double), 1, file)) throw std::runtime_error("Unexpected end of file");
+
+	return h;
+}
+
+void LasPointReader::init_record_layout() {
+	// Point formats 6 to 10 (LAS 1.4) have a different layout than the legacy formats
+	uint8_t format = header.point_format & 0x3F;
+	switch (format) {
+	case 1: case 4: gps_time_offset = 20; color_offset = 0; break;
+	case 2: gps_time_offset = 0; color_offset = 20; break;
+	case 3: case 5: gps_time_offset = 20; color_offset = 28; break;
+	case 6: case 9: gps_time_offset = 22; color_offset = 0; break;
+	case 7: case 8: case 10: gps_time_offset = 22; color_offset = 30; break;
+	default: gps_time_offset = 0; color_offset = 0; break;
+	}
+	record.resize(std::max<uint16_t>(header.point_record_length, 20));
+}
+
+void LasPointReader::open(std::string filename) {
+	file = fopen(filename.c_str(), "rb");
+	if (!file) throw std::runtime_error("Could not open file");
+
+	header = read_header(file);
+	init_record_layout();
 
-	fread(&offset_x, sizeof(double), 1, file);
-	fread(&offset_y, sizeof(double), 1, file);
-	fread(&offset_z, sizeof(double), 1, file);
+	fseek(file, header.first_point_offset, SEEK_SET); // Jump to the first point to continue
+}
 
-	fread(&max_x, sizeof(double), 1, file);
-	fread(&min_x, sizeof(double), 1, file);
-	fread(&max_y, sizeof(double), 1, file);
-	fread(&min_y, sizeof(double), 1, file);
-	fread(&max_z, sizeof(double), 1, file);
-	fread(&min_z, sizeof(double), 1, file);
+void LasPointReader::open(std::string filename, const LasHeader& header) {
+	file = fopen(filename.c_str(), "rb");
+	if (!file) throw std::runtime_error("Could not open file");
 
+	this->header = header;
+	init_record_layout();
 
-	fseek(file, first_point_offset, SEEK_SET); // Jump to the first point to continue
+	fseek(file, header.first_point_offset, SEEK_SET);
 }
 
 bool LasPointReader::has_points() {
-	return points_read < num_points;
+	return points_read < header.num_points;
 }
 
 Point LasPointReader::read_point() {
-	Point p;
+	PointAttributes attributes;
+	return read_point(attributes);
+}
+
+Point LasPointReader::read_point(PointAttributes& attributes) {
+	// Read the whole record at once and pick the fields from it
+	if (!fread(record.data(), header.point_record_length, 1, file)) throw std::runtime_error("Unexpected end of file");
+	const uint8_t* r = record.data();
 
-	bool cx, cy, cz;
+	Point p;
 	int32_t x, y, z;
-	cx = fread(&x, sizeof(int32_t), 1, file);
-	cy = fread(&y, sizeof(int32_t), 1, file);
-	cz = fread(&z, sizeof(int32_t), 1, file);
-	if (!(cx && cy && cz)) throw std::runtime_error("Unexpected end of file");
-
-	p.x = x * scale_x + offset_x;
-	p.y = y * scale_y + offset_y;
-	p.z = z * scale_z + offset_z;
-
-	if (point_format == 2) { // It has colors!
-		fseek(file, skip_bytes - 3 * sizeof(uint16_t), SEEK_CUR);
-		cx = fread(&p.r, sizeof(uint16_t), 1, file);
-		cy = fread(&p.g, sizeof(uint16_t), 1, file);
-		cz = fread(&p.b, sizeof(uint16_t), 1, file);
+	memcpy(&x, r, sizeof(int32_t));
+	memcpy(&y, r + 4, sizeof(int32_t));
+	memcpy(&z, r + 8, sizeof(int32_t));
+
+	p.x = x * header.scale_x + header.offset_x;
+	p.y = y * header.scale_y + header.offset_y;
+	p.z = z * header.scale_z + header.offset_z;
+
+	if (color_offset) { // It has colors!
+		memcpy(&p.r, r + color_offset, sizeof(uint16_t));
+		memcpy(&p.g, r + color_offset + 2, sizeof(uint16_t));
+		memcpy(&p.b, r + color_offset + 4, sizeof(uint16_t));
 	}
 	else {
-		fseek(file, skip_bytes, SEEK_CUR);
 		p.r = 0;
 		p.g = 0;
 		p.b = 0;
 	}
-	if (!(cx && cy && cz)) throw std::runtime_error("Unexpected end of file");
+
+	memcpy(&attributes.intensity, r + 12, sizeof(uint16_t));
+	if ((header.point_format & 0x3F) >= 6) {
+		attributes.return_number = r[14] & 0x0F;
+		attributes.number_of_returns = r[14] >> 4;
+		attributes.classification = r[16];
+	}
+	else {
+		attributes.return_number = r[14] & 0x07;
+		attributes.number_of_returns = (r[14] >> 3) & 0x07;
+		attributes.classification = r[15] & 0x1F;
+	}
+	attributes.gps_time = 0.0;
+	if (gps_time_offset) memcpy(&attributes.gps_time, r + gps_time_offset, sizeof(double));
 
 	points_read++;
 
@@ -85,40 +137,15 @@ Point LasPointReader::read_point() {
 
 Cube LasPointReader::get_bounding_cube() {
 	Cube c;
-	c.center_x =(float)((max_x + min_x) / 2.0);
-	c.center_y =(float)((max_y + min_y) / 2.0);
-	c.center_z =(float)((max_z + min_z) / 2.0);
+	c.center_x =(float)((header.max_x + header.min_x) / 2.0);
+	c.center_y =(float)((header.max_y + header.min_y) / 2.0);
+	c.center_z =(float)((header.max_z + header.min_z) / 2.0);
 
-	c.size = std::max(max_x - min_x, std::max(max_y - min_y, max_z - min_z));
+	c.size = std::max(header.max_x - header.min_x, std::max(header.max_y - header.min_y, header.max_z - header.min_z));
 	return c;
 }
 
 Bounds LasPointReader::get_bounds() {
-	return { (float)min_x, (float)min_y, (float)min_z, (float)max_x, (float)max_y, (float)max_z };
+	return { (float)header.min_x, (float)header.min_y, (float)header.min_z,
+		(float)header.max_x, (float)header.max_y, (float)header.max_z };
 }
-
-Cube LasPointReader::get_big_bounding_cube(std::vector<std::string> input_files, uint64_t& total_points) {
-	Bounds g_bounds;
-	for (std::string s : input_files) {
-		LasPointReader r;
-		r.open(s);
-		total_points += r.num_points;
-		Bounds b = r.get_bounds();
-		if (b.max_x > g_bounds.max_x) g_bounds.max_x = b.max_x;
-		if (b.max_y > g_bounds.max_y) g_bounds.max_y = b.max_y;
-		if (b.max_z > g_bounds.max_z) g_bounds.max_z = b.max_z;
-
-		if (b.min_x < g_bounds.min_x) g_bounds.min_x = b.min_x;
-		if (b.min_y < g_bounds.min_y) g_bounds.min_y = b.min_y;
-		if (b.min_z < g_bounds.min_z) g_bounds.min_z = b.min_z;
-	}
-	Cube c;
-	// Cast to double to avoid overflow when adding
-	c.center_x = (float)(((double)g_bounds.max_x + (double)g_bounds.min_x) / 2.0);
-	c.center_y = (float)(((double)g_bounds.max_y + (double)g_bounds.min_y) / 2.0);
-	c.center_z = (float)(((double)g_bounds.max_z + (double)g_bounds.min_z) / 2.0);
-
-	c.size = std::max(g_bounds.max_x - g_bounds.min_x,
-		std::max(g_bounds.max_y - g_bounds.min_y, g_bounds.max_z - g_bounds.min_z));
-	return c;
-}
\ No newline at end of file
@@ -1,24 +1,37 @@
 #pragma once
 #include "PointReader.h"
 
-class LasPointReader : public PointReader {
-private:
+// Header fields of a LAS file that are needed to read its points
+struct LasHeader {
 	uint64_t num_points;
-	uint64_t points_read = 0;
 	double scale_x, scale_y, scale_z;
 	double offset_x, offset_y, offset_z;
 	double min_x, max_x, min_y, max_y, min_z, max_z;
 	uint32_t first_point_offset;
-	uint16_t skip_bytes;
+	uint16_t point_record_length;
 	uint8_t point_format;
+};
+
+class LasPointReader : public PointReader {
+private:
+	LasHeader header;
+	uint64_t points_read = 0;
+	std::vector<uint8_t> record;
+	uint16_t color_offset; // 0 if the point format has no colors
+	uint16_t gps_time_offset; // 0 if the point format has no GPS time
+
+	void init_record_layout();
 
 public:
 	void open(std::string filename) override;
+	// Open a file whose header has already been read (e.g. from the input manifest)
+	void open(std::string filename, const LasHeader& header);
 	bool has_points() override;
 	Point read_point() override;
+	Point read_point(PointAttributes& attributes) override;
 
 	Cube get_bounding_cube();
 	Bounds get_bounds();
 
-	static Cube get_big_bounding_cube(std::vector<std::string> input_files, uint64_t& total_points);
-};
\ No newline at end of file
+	static LasHeader read_header(FILE* file);
+};
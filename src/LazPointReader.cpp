@@ -0,0 +1,198 @@
+#include "LazPointReader.h"
+#include <stdexcept>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+#ifdef PCC_WITH_LASZIP
+#include <laszip/laszip_api.h>
+#endif
+
+// Points per decoded range if the chunk size is unknown, ranges are always a multiple of the chunk size
+#define LAZ_MIN_RANGE_SIZE 500'000
+#define LASZIP_VLR_RECORD_ID 22204
+
+uint32_t LazPointReader::read_chunk_size(FILE* file) {
+	uint16_t header_size;
+	uint32_t num_vlrs;
+	fseek(file, 94, SEEK_SET);
+	fread(&header_size, sizeof(uint16_t), 1, file);
+	fseek(file, 100, SEEK_SET);
+	fread(&num_vlrs, sizeof(uint32_t), 1, file);
+
+	long vlr_offset = header_size;
+	for (uint32_t i = 0; i < num_vlrs; i++) {
+		char user_id[17] = { 0 };
+		uint16_t record_id, record_length;
+		fseek(file, vlr_offset + 2, SEEK_SET);
+		fread(user_id, 1, 16, file);
+		fread(&record_id, sizeof(uint16_t), 1, file);
+		if (!fread(&record_length, sizeof(uint16_t), 1, file)) break;
+
+		if (strcmp(user_id, "laszip encoded") == 0 && record_id == LASZIP_VLR_RECORD_ID) {
+			// compressor, coder, version major, minor, revision, options, then the chunk size
+			uint32_t chunk_size = 0;
+			fseek(file, vlr_offset + 54 + 12, SEEK_SET);
+			fread(&chunk_size, sizeof(uint32_t), 1, file);
+			return chunk_size == UINT32_MAX ? 0 : chunk_size;
+		}
+		vlr_offset += 54 + record_length;
+	}
+	throw std::runtime_error("Not a LAZ file (no LASzip record)");
+}
+
+bool LazPointReader::is_supported() {
+#ifdef PCC_WITH_LASZIP
+	return true;
+#else
+	return false;
+#endif
+}
+
+void LazPointReader::open(std::string filename) {
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (!f) throw std::runtime_error("Could not open file");
+	LasHeader header;
+	try {
+		header = LasPointReader::read_header(f);
+	}
+	catch (...) {
+		fclose(f);
+		throw;
+	}
+	fclose(f);
+	open(filename, header);
+}
+
+void LazPointReader::open(std::string filename, const LasHeader& header) {
+	if (!is_supported()) throw std::runtime_error("LAZ input requires building with LASzip");
+
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (!f) throw std::runtime_error("Could not open file");
+	uint32_t chunk_size;
+	try {
+		chunk_size = read_chunk_size(f);
+	}
+	catch (...) {
+		fclose(f);
+		throw;
+	}
+	fclose(f);
+
+	this->filename = filename;
+	this->header = header;
+	num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	// Decode whole chunks per range, seeking to the start of a chunk only needs the chunk table
+	range_size = LAZ_MIN_RANGE_SIZE;
+	if (chunk_size) range_size = std::max<uint64_t>(1, LAZ_MIN_RANGE_SIZE / chunk_size) * chunk_size;
+
+	schedule_ranges();
+}
+
+void LazPointReader::schedule_ranges() {
+	// Keep one range per thread in flight, this bounds the memory used for decoded points
+	while (pending_ranges.size() < num_threads && next_range_start < header.num_points) {
+		uint64_t start = next_range_start;
+		uint64_t count = std::min(range_size, header.num_points - start);
+		next_range_start += count;
+		pending_ranges.push_back(std::async(std::launch::async, [this, start, count] {
+			return decode_range(start, count);
+		}));
+	}
+}
+
+LazPointReader::Range LazPointReader::decode_range(uint64_t start, uint64_t count) {
+	Range range;
+#ifdef PCC_WITH_LASZIP
+	laszip_POINTER reader = nullptr;
+	if (laszip_create(&reader)) throw std::runtime_error("Could not create LASzip reader");
+
+	auto fail = [&](const std::string& what) {
+		laszip_CHAR* error = nullptr;
+		laszip_get_error(reader, &error);
+		std::string message = what + (error ? " (" + std::string(error) + ")" : "");
+		laszip_destroy(reader);
+		throw std::runtime_error(message);
+	};
+
+	laszip_BOOL is_compressed = 0;
+	if (laszip_open_reader(reader, filename.c_str(), &is_compressed)) fail("Could not open LAZ file");
+
+	laszip_header_struct* h;
+	laszip_point_struct* p;
+	laszip_get_header_pointer(reader, &h);
+	laszip_get_point_pointer(reader, &p);
+	if (start > 0 && laszip_seek_point(reader, start)) fail("Could not seek in LAZ file");
+
+	uint8_t format = h->point_data_format & 0x3F;
+	bool has_colors = format == 2 || format == 3 || format == 5 || format == 7 || format == 8 || format == 10;
+
+	range.points.resize(count);
+	range.attributes.resize(count);
+	for (uint64_t i = 0; i < count; i++) {
+		if (laszip_read_point(reader)) fail("Could not read point from LAZ file");
+		Point& pt = range.points[i];
+		pt.x = p->X * h->x_scale_factor + h->x_offset;
+		pt.y = p->Y * h->y_scale_factor + h->y_offset;
+		pt.z = p->Z * h->z_scale_factor + h->z_offset;
+		if (has_colors) {
+			pt.r = p->rgb[0];
+			pt.g = p->rgb[1];
+			pt.b = p->rgb[2];
+		}
+		else {
+			pt.r = pt.g = pt.b = 0;
+		}
+
+		PointAttributes& a = range.attributes[i];
+		a.intensity = p->intensity;
+		a.gps_time = p->gps_time;
+		if (format >= 6) {
+			a.return_number = p->extended_return_number;
+			a.number_of_returns = p->extended_number_of_returns;
+			a.classification = p->extended_classification;
+		}
+		else {
+			a.return_number = p->return_number;
+			a.number_of_returns = p->number_of_returns;
+			a.classification = p->classification;
+		}
+	}
+
+	laszip_close_reader(reader);
+	laszip_destroy(reader);
+#else
+	// open() does not schedule ranges without LASzip
+	(void)start;
+	(void)count;
+#endif
+	return range;
+}
+
+bool LazPointReader::has_points() {
+	return points_read < header.num_points;
+}
+
+Point LazPointReader::read_point() {
+	PointAttributes attributes;
+	return read_point(attributes);
+}
+
+Point LazPointReader::read_point(PointAttributes& attributes) {
+	if (batch_cursor >= batch.points.size()) {
+		if (pending_ranges.empty()) throw std::runtime_error("Unexpected end of file");
+		batch = pending_ranges.front().get();
+		pending_ranges.pop_front();
+		batch_cursor = 0;
+		schedule_ranges();
+		if (batch.points.empty()) throw std::runtime_error("Unexpected end of file");
+	}
+	points_read++;
+	attributes = batch.attributes[batch_cursor];
+	return batch.points[batch_cursor++];
+}
+
+LazPointReader::~LazPointReader() {
+	for (auto& f : pending_ranges) f.wait();
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <deque>
+#include <future>
+#include <vector>
+#include "PointReader.h"
+#include "LasPointReader.h"
+
+// Reads LAZ (compressed LAS) files using LASzip. The points of a LAZ file are
+// compressed in independent chunks, so the file is split into chunk-aligned ranges
+// that are decompressed in parallel and handed out in order.
+//
+// Only available when built with LASzip (PCC_WITH_LASZIP), open throws otherwise.
+class LazPointReader : public PointReader {
+private:
+	std::string filename;
+	LasHeader header;
+	uint64_t points_read = 0;
+	uint64_t range_size;
+	uint64_t next_range_start = 0;
+	unsigned int num_threads;
+
+	struct Range {
+		std::vector<Point> points;
+		std::vector<PointAttributes> attributes;
+	};
+
+	std::deque<std::future<Range>> pending_ranges;
+	Range batch;
+	uint64_t batch_cursor = 0;
+
+	Range decode_range(uint64_t start, uint64_t count);
+	void schedule_ranges();
+
+public:
+	void open(std::string filename) override;
+	void open(std::string filename, const LasHeader& header);
+	bool has_points() override;
+	Point read_point() override;
+	Point read_point(PointAttributes& attributes) override;
+
+	~LazPointReader();
+
+	// Number of points per compressed chunk, 0 if the chunks have variable size
+	static uint32_t read_chunk_size(FILE* file);
+	static bool is_supported();
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "PointReader.h"
+
+// Points that are handed to the builder in memory instead of in a file
+struct PointBatch {
+	std::vector<Point> points;
+	std::vector<PointAttributes> attributes; // Empty, or one entry per point
+};
+
+class MemoryPointReader : public PointReader {
+private:
+	std::shared_ptr<const PointBatch> batch;
+	uint64_t points_read = 0;
+
+public:
+	MemoryPointReader(std::shared_ptr<const PointBatch> batch) : batch(batch) {}
+
+	bool has_points() override {
+		return points_read < batch->points.size();
+	}
+
+	Point read_point() override {
+		return batch->points[points_read++];
+	}
+
+	Point read_point(PointAttributes& attributes) override {
+		attributes = batch->attributes.empty() ? PointAttributes() : batch->attributes[points_read];
+		return read_point();
+	}
+};
@@ -0,0 +1,134 @@
+#include "MortonSorter.h"
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include "Utils.h"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+// Below this many points a single thread is faster than splitting the passes up
+#define PARALLEL_SORT_MIN_POINTS (1 << 18)
+
+// Spread the lower 10 bits of v so that there are two zero bits between each of them
+static inline uint32_t spread_bits(uint32_t v) {
+	v &= 0x3FF;
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+static inline uint32_t get_morton_code(const Point& p, const Cube& bounds) {
+	const uint32_t resolution = 1 << MORTON_BITS_PER_AXIS;
+	float edge = bounds.size * 2.0f;
+	float scale = edge > 0.0f ? resolution / edge : 0.0f;
+	uint32_t x = (uint32_t)std::clamp((int64_t)((p.x - (bounds.center_x - bounds.size)) * scale), (int64_t)0, (int64_t)resolution - 1);
+	uint32_t y = (uint32_t)std::clamp((int64_t)((p.y - (bounds.center_y - bounds.size)) * scale), (int64_t)0, (int64_t)resolution - 1);
+	uint32_t z = (uint32_t)std::clamp((int64_t)((p.z - (bounds.center_z - bounds.size)) * scale), (int64_t)0, (int64_t)resolution - 1);
+	// Same axis order as the child index: x is the most significant bit of each octant
+	return (spread_bits(x) << 2) | (spread_bits(y) << 1) | spread_bits(z);
+}
+
+void MortonSorter::radix_sort() {
+	uint64_t n = keys.size();
+	scratch.resize(n);
+
+	uint32_t num_blocks = 1;
+	if (n >= PARALLEL_SORT_MIN_POINTS) num_blocks = std::max(1u, std::thread::hardware_concurrency());
+	uint64_t block_size = (n + num_blocks - 1) / num_blocks;
+	std::vector<uint64_t> counts((size_t)num_blocks * RADIX_BUCKETS);
+
+	auto for_blocks = [&](auto f) {
+		if (num_blocks == 1) {
+			f(0);
+			return;
+		}
+		std::vector<std::future<void>> futures;
+		for (uint32_t b = 1; b < num_blocks; b++) futures.push_back(std::async(std::launch::async, f, b));
+		f(0);
+		for (auto& future : futures) future.get();
+	};
+
+	const int code_bits = MORTON_BITS_PER_AXIS * 3;
+	for (int shift = 32; shift < 32 + code_bits; shift += RADIX_BITS) {
+		std::fill(counts.begin(), counts.end(), 0);
+		for_blocks([&](uint32_t b) {
+			uint64_t* c = &counts[(size_t)b * RADIX_BUCKETS];
+			uint64_t end = std::min(n, (b + 1) * block_size);
+			for (uint64_t i = b * block_size; i < end; i++) c[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+		});
+
+		// Turn the counts into start positions, bucket by bucket and block by block in each
+		// bucket, so the sort stays stable. A digit that is the same for all keys is skipped.
+		uint64_t position = 0;
+		bool skip = false;
+		for (uint32_t d = 0; d < RADIX_BUCKETS; d++) {
+			uint64_t bucket_start = position;
+			for (uint32_t b = 0; b < num_blocks; b++) {
+				uint64_t c = counts[(size_t)b * RADIX_BUCKETS + d];
+				counts[(size_t)b * RADIX_BUCKETS + d] = position;
+				position += c;
+			}
+			if (position - bucket_start == n) skip = true;
+		}
+		if (skip) continue;
+
+		for_blocks([&](uint32_t b) {
+			uint64_t* c = &counts[(size_t)b * RADIX_BUCKETS];
+			uint64_t end = std::min(n, (b + 1) * block_size);
+			for (uint64_t i = b * block_size; i < end; i++) scratch[c[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++] = keys[i];
+		});
+		keys.swap(scratch);
+	}
+}
+
+void MortonSorter::sort(PointBuffer& points, AttributeColumns& attributes, const Cube& bounds) {
+	uint64_t n = points.size();
+	if (n > UINT32_MAX) throw std::runtime_error("Too many points in one node to sort");
+
+	keys.resize(n);
+	for (uint64_t i = 0; i < n; i++) keys[i] = ((uint64_t)get_morton_code(points[i], bounds) << 32) | i;
+	radix_sort();
+
+	order.resize(n);
+	for (uint64_t i = 0; i < n; i++) order[i] = keys[i] & 0xFFFFFFFF;
+
+	PointBuffer sorted(n);
+	for (uint64_t i = 0; i < n; i++) sorted[i] = points[order[i]];
+	points.swap(sorted);
+
+	if (!attributes.empty()) {
+		AttributeColumns sorted_attributes;
+		sorted_attributes.gather(attributes, order);
+		std::swap(attributes, sorted_attributes);
+	}
+}
+
+void MortonSorter::get_block_offsets(uint8_t depth, std::vector<uint32_t>& offsets) const {
+	uint64_t num_blocks = 1ull << (3 * depth);
+	int shift = 32 + MORTON_BITS_PER_AXIS * 3 - 3 * depth;
+	offsets.assign(num_blocks + 1, 0);
+	// Count the points per block, the keys are sorted so the prefix sums are the block starts
+	for (uint64_t key : keys) offsets[(key >> shift) + 1]++;
+	for (uint64_t b = 1; b <= num_blocks; b++) offsets[b] += offsets[b - 1];
+}
+
+MortonSorter& MortonSorter::for_thread() {
+	thread_local MortonSorter sorter;
+	return sorter;
+}
+
+void write_block_index(const std::string& point_file, const MortonSorter& sorter, uint8_t depth) {
+	std::vector<uint32_t> offsets;
+	sorter.get_block_offsets(depth, offsets);
+
+	FILE* file = fopen(get_attribute_file(point_file, "index").c_str(), "wb");
+	if (!file) THROW_FILE_OPEN_ERROR;
+	fwrite(&depth, sizeof(uint8_t), 1, file);
+	fwrite(offsets.data(), sizeof(uint32_t), offsets.size(), file);
+	fclose(file);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+#include "Data.h"
+
+// Bits per axis of the Morton codes, enough to order the points of a node of any size
+#define MORTON_BITS_PER_AXIS 10
+// Deepest level of the sub-block index, 8^4 blocks per node
+#define MORTON_MAX_INDEX_DEPTH 4
+
+// Orders the points of a node along a Morton curve through the node cube, so points that
+// are close in space are close in the file. Uses an LSD radix sort on the codes; large
+// nodes are counted and scattered in parallel blocks. The scratch buffers are kept
+// between nodes.
+class MortonSorter {
+private:
+	std::vector<uint64_t> keys; // Morton code in the high, point index in the low 32 bits
+	std::vector<uint64_t> scratch;
+	std::vector<uint64_t> order;
+
+	void radix_sort();
+
+public:
+	// Sort the points and permute their attribute columns the same way
+	void sort(PointBuffer& points, AttributeColumns& attributes, const Cube& bounds);
+
+	// Point ranges of the sub-blocks at the given depth of the last sorted node: block b
+	// holds the points [offsets[b], offsets[b + 1]), 8^depth + 1 offsets in total
+	void get_block_offsets(uint8_t depth, std::vector<uint32_t>& offsets) const;
+
+	// Sorter with scratch space owned by the calling thread
+	static MortonSorter& for_thread();
+};
+
+// Write the sub-block offsets of the last node sorted by sorter next to its point file
+void write_block_index(const std::string& point_file, const MortonSorter& sorter, uint8_t depth);
@@ -0,0 +1,82 @@
+#include "NodeFile.h"
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include "Utils.h"
+
+NodeFileWriter::NodeFileWriter(const std::string& point_file, const AttributeSchema& schema, bool append) : schema(schema) {
+	const char* mode = append ? "ab" : "wb";
+	points_file = fopen(point_file.c_str(), mode);
+	if (!points_file) THROW_FILE_OPEN_ERROR;
+	for (size_t i = 0; i < schema.size(); i++) {
+		FILE* file = fopen(get_attribute_file(point_file, AttributeSchema::get_name(schema.get(i))).c_str(), mode);
+		if (!file) THROW_FILE_OPEN_ERROR;
+		attribute_files.push_back(file);
+	}
+}
+
+NodeFileWriter::~NodeFileWriter() {
+	if (points_file) fclose(points_file);
+	for (FILE* file : attribute_files) fclose(file);
+}
+
+void NodeFileWriter::write(const Point& p, const PointAttributes& a) {
+	fwrite(&p, sizeof(struct Point), 1, points_file);
+	for (size_t i = 0; i < attribute_files.size(); i++) {
+		schema.encode(i, a, value);
+		fwrite(value, AttributeSchema::get_size(schema.get(i)), 1, attribute_files[i]);
+	}
+}
+
+void NodeFileWriter::write(const Point* points, const PointAttributes* attributes, uint64_t n) {
+	fwrite(points, sizeof(struct Point), n, points_file);
+	for (size_t i = 0; i < attribute_files.size(); i++) {
+		uint32_t size = AttributeSchema::get_size(schema.get(i));
+		for (uint64_t j = 0; j < n; j++) {
+			schema.encode(i, attributes[j], value);
+			fwrite(value, size, 1, attribute_files[i]);
+		}
+	}
+}
+
+void NodeFileWriter::write(const PointBuffer& points, const AttributeColumns& columns) {
+	fwrite(points.data(), sizeof(struct Point), points.size(), points_file);
+	for (size_t i = 0; i < attribute_files.size(); i++) {
+		fwrite(columns.columns[i].data(), 1, columns.columns[i].size(), attribute_files[i]);
+	}
+}
+
+void read_node_file(const std::string& point_file, const AttributeSchema& schema, uint64_t num_points,
+	PointBuffer& points, AttributeColumns& columns) {
+	FILE* file = fopen(point_file.c_str(), "rb");
+	if (!file) THROW_FILE_OPEN_ERROR;
+	points.resize(num_points);
+	uint64_t n = fread(points.data(), sizeof(struct Point), num_points, file);
+	fclose(file);
+	if (n != num_points) throw std::runtime_error("Unexpected end of file");
+
+	columns.init(schema.get_strides());
+	for (size_t i = 0; i < schema.size(); i++) {
+		file = fopen(get_attribute_file(point_file, AttributeSchema::get_name(schema.get(i))).c_str(), "rb");
+		if (!file) THROW_FILE_OPEN_ERROR;
+		columns.columns[i].resize(num_points * columns.strides[i]);
+		n = fread(columns.columns[i].data(), columns.strides[i], num_points, file);
+		fclose(file);
+		if (n != num_points) throw std::runtime_error("Unexpected end of attribute file");
+	}
+}
+
+void remove_node_file(const std::string& point_file, const AttributeSchema& schema) {
+	std::filesystem::remove(point_file);
+	for (size_t i = 0; i < schema.size(); i++) {
+		std::filesystem::remove(get_attribute_file(point_file, AttributeSchema::get_name(schema.get(i))));
+	}
+}
+
+void rename_node_file(const std::string& from, const std::string& to, const AttributeSchema& schema) {
+	std::filesystem::rename(from, to);
+	for (size_t i = 0; i < schema.size(); i++) {
+		const char* name = AttributeSchema::get_name(schema.get(i));
+		std::filesystem::rename(get_attribute_file(from, name), get_attribute_file(to, name));
+	}
+}
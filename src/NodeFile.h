@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Data.h"
+#include "AttributeSchema.h"
+
+// Writes the point file of a node together with one column file per attribute of the schema
+class NodeFileWriter {
+private:
+	const AttributeSchema& schema;
+	FILE* points_file = nullptr;
+	std::vector<FILE*> attribute_files;
+	uint8_t value[sizeof(double)];
+
+public:
+	// With append the points are added to the end of existing files
+	NodeFileWriter(const std::string& point_file, const AttributeSchema& schema, bool append = false);
+	~NodeFileWriter();
+
+	void write(const Point& p, const PointAttributes& a);
+	void write(const Point* points, const PointAttributes* attributes, uint64_t n);
+	void write(const PointBuffer& points, const AttributeColumns& columns);
+};
+
+// Load the points of a node file and its attribute columns
+void read_node_file(const std::string& point_file, const AttributeSchema& schema, uint64_t num_points,
+	PointBuffer& points, AttributeColumns& columns);
+
+void remove_node_file(const std::string& point_file, const AttributeSchema& schema);
+
+void rename_node_file(const std::string& from, const std::string& to, const AttributeSchema& schema);
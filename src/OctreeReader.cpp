@@ -0,0 +1,392 @@
+#include "OctreeReader.h"
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+#include <queue>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "Utils.h"
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define HIERARCHY_NODE_SIZE (sizeof(uint64_t) + sizeof(uint8_t))
+// Tight bounds and spacing of version 2, followed by the color range with HIERARCHY_FLAG_COLORS
+#define HIERARCHY_STATS_SIZE (sizeof(Bounds) + sizeof(float))
+#define HIERARCHY_COLORS_SIZE (6 * sizeof(uint16_t))
+
+Frustum Frustum::from_matrix(const float m[16]) {
+	Frustum f;
+	auto row = [&](int r, int c) { return m[c * 4 + r]; };
+	for (int i = 0; i < 3; i++) {
+		for (int c = 0; c < 4; c++) {
+			f.planes[i * 2][c] = row(3, c) + row(i, c);
+			f.planes[i * 2 + 1][c] = row(3, c) - row(i, c);
+		}
+	}
+	return f;
+}
+
+bool Frustum::intersects(const Cube& cube) const {
+	for (int i = 0; i < 6; i++) {
+		const float* p = planes[i];
+		// Corner of the cube that is furthest along the plane normal
+		float x = cube.center_x + (p[0] >= 0.0f ? cube.size : -cube.size);
+		float y = cube.center_y + (p[1] >= 0.0f ? cube.size : -cube.size);
+		float z = cube.center_z + (p[2] >= 0.0f ? cube.size : -cube.size);
+		if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f) return false;
+	}
+	return true;
+}
+
+bool Frustum::intersects(const Bounds& bounds) const {
+	for (int i = 0; i < 6; i++) {
+		const float* p = planes[i];
+		float x = p[0] >= 0.0f ? bounds.max_x : bounds.min_x;
+		float y = p[1] >= 0.0f ? bounds.max_y : bounds.min_y;
+		float z = p[2] >= 0.0f ? bounds.max_z : bounds.min_z;
+		if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f) return false;
+	}
+	return true;
+}
+
+bool Frustum::contains(const Point& pt) const {
+	for (int i = 0; i < 6; i++) {
+		const float* p = planes[i];
+		if (p[0] * pt.x + p[1] * pt.y + p[2] * pt.z + p[3] < 0.0f) return false;
+	}
+	return true;
+}
+
+static bool box_intersects(const Bounds& box, const Bounds& bounds) {
+	return bounds.max_x >= box.min_x && bounds.min_x <= box.max_x
+		&& bounds.max_y >= box.min_y && bounds.min_y <= box.max_y
+		&& bounds.max_z >= box.min_z && bounds.min_z <= box.max_z;
+}
+
+static bool box_contains(const Bounds& box, const Point& p) {
+	return p.x >= box.min_x && p.x <= box.max_x && p.y >= box.min_y && p.y <= box.max_y
+		&& p.z >= box.min_z && p.z <= box.max_z;
+}
+
+void NodeCache::evict() {
+	// Entries that are still loading have no size yet and are kept
+	auto it = lru.end();
+	while (bytes > capacity && it != lru.begin()) {
+		--it;
+		auto entry = entries.find(*it);
+		if (entry->second.bytes == 0) continue;
+		bytes -= entry->second.bytes;
+		entries.erase(entry);
+		it = lru.erase(it);
+	}
+}
+
+NodeCache::Points NodeCache::get(uint32_t node, const std::function<Points()>& load) {
+	std::promise<Points> promise;
+	std::unique_lock<std::mutex> guard(lock);
+	auto found = entries.find(node);
+	if (found != entries.end()) {
+		hits++;
+		lru.splice(lru.begin(), lru, found->second.lru);
+		std::shared_future<Points> points = found->second.points;
+		guard.unlock();
+		return points.get();
+	}
+	misses++;
+	lru.push_front(node);
+	entries[node] = { promise.get_future().share(), 0, lru.begin() };
+	guard.unlock();
+
+	Points points;
+	try {
+		points = load();
+	}
+	catch (...) {
+		guard.lock();
+		auto it = entries.find(node);
+		lru.erase(it->second.lru);
+		entries.erase(it);
+		promise.set_exception(std::current_exception());
+		throw;
+	}
+	promise.set_value(points);
+
+	guard.lock();
+	auto it = entries.find(node);
+	if (it != entries.end()) {
+		it->second.bytes = std::max<uint64_t>(1, points->size() * sizeof(struct Point));
+		bytes += it->second.bytes;
+		evict();
+	}
+	return points;
+}
+
+NodeCache::Points NodeCache::find(uint32_t node) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = entries.find(node);
+	if (it == entries.end() || it->second.bytes == 0) return nullptr;
+	hits++;
+	lru.splice(lru.begin(), lru, it->second.lru);
+	return it->second.points.get();
+}
+
+uint64_t NodeCache::get_hits() {
+	std::lock_guard<std::mutex> guard(lock);
+	return hits;
+}
+
+uint64_t NodeCache::get_misses() {
+	std::lock_guard<std::mutex> guard(lock);
+	return misses;
+}
+
+OctreeReader::OctreeReader(const std::string& output_path, uint64_t cache_bytes, uint32_t num_threads) : cache(cache_bytes) {
+	this->output_path = output_path;
+	this->num_threads = num_threads ? num_threads : std::max(1u, std::thread::hardware_concurrency());
+
+	std::string path = output_path + "/hierarchy.bin";
+#ifdef _WIN32
+	std::ifstream file(path, std::ios::binary);
+	if (!file) throw std::runtime_error("Could not open hierarchy file");
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	parse_hierarchy(data.data(), data.size());
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw std::runtime_error("Could not open hierarchy file");
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		throw std::runtime_error("Could not read hierarchy file");
+	}
+	void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) throw std::runtime_error("Could not map hierarchy file");
+	try {
+		parse_hierarchy((const uint8_t*)data, st.st_size);
+	}
+	catch (...) {
+		munmap(data, st.st_size);
+		throw;
+	}
+	munmap(data, st.st_size);
+#endif
+}
+
+void OctreeReader::parse_hierarchy(const uint8_t* data, uint64_t size) {
+	// Files without a header are version 1
+	HierarchyHeader header = { { 0, 0, 0, 0 }, 1, 0 };
+	uint64_t cursor = 0;
+	if (size >= sizeof(HierarchyHeader) && memcmp(data, HIERARCHY_MAGIC, 4) == 0) {
+		memcpy(&header, data, sizeof(HierarchyHeader));
+		cursor = sizeof(HierarchyHeader);
+	}
+	if (header.version > HIERARCHY_VERSION) throw std::runtime_error("Unsupported hierarchy version " + std::to_string(header.version));
+
+	// Size of a node record without the octants of its skipped levels, which follow the count
+	// and the mask, and of the statistics at its end
+	uint64_t stats_size = 0;
+	if (header.version >= 2) stats_size += HIERARCHY_STATS_SIZE;
+	if (header.flags & HIERARCHY_FLAG_COLORS) stats_size += HIERARCHY_COLORS_SIZE;
+	uint64_t node_size = HIERARCHY_NODE_SIZE + stats_size;
+	if (header.flags & HIERARCHY_FLAG_SKIPPED_LEVELS) node_size += sizeof(uint8_t);
+	if (size < cursor + sizeof(Cube) + node_size) throw std::runtime_error("Invalid hierarchy file");
+
+	OctreeNode root;
+	memcpy(&root.bounds, data + cursor, sizeof(Cube));
+	root.level = 0;
+	nodes.push_back(root);
+	cursor += sizeof(Cube);
+
+	// The file lists the nodes depth first, the children of a node get consecutive slots
+	// as soon as its mask is known
+	std::function<void(uint32_t)> parse = [&](uint32_t index) {
+		if (cursor + node_size > size) throw std::runtime_error("Unexpected end of hierarchy file");
+		OctreeNode& current = nodes[index];
+		memcpy(&current.num_points, data + cursor, sizeof(uint64_t));
+		current.child_nodes_mask = data[cursor + sizeof(uint64_t)];
+		cursor += HIERARCHY_NODE_SIZE;
+		if (header.flags & HIERARCHY_FLAG_SKIPPED_LEVELS) {
+			uint8_t skipped_levels = data[cursor++];
+			if (cursor + skipped_levels + stats_size > size) throw std::runtime_error("Unexpected end of hierarchy file");
+			for (uint8_t i = 0; i < skipped_levels; i++) {
+				uint8_t octant = data[cursor++];
+				if (octant > 7) throw std::runtime_error("Invalid hierarchy file");
+				current.bounds = current.bounds.get_octant(octant);
+				current.id += std::to_string(octant);
+			}
+			current.level += skipped_levels;
+		}
+		const uint8_t* record = data + cursor;
+		if (header.version >= 2) {
+			memcpy(&current.tight_bounds, record, sizeof(Bounds));
+			memcpy(&current.spacing, record + sizeof(Bounds), sizeof(float));
+			record += HIERARCHY_STATS_SIZE;
+		}
+		else {
+			const Cube& c = current.bounds;
+			current.tight_bounds.min_x = c.center_x - c.size; current.tight_bounds.max_x = c.center_x + c.size;
+			current.tight_bounds.min_y = c.center_y - c.size; current.tight_bounds.max_y = c.center_y + c.size;
+			current.tight_bounds.min_z = c.center_z - c.size; current.tight_bounds.max_z = c.center_z + c.size;
+			// Assume the points cover a surface through the cube
+			current.spacing = c.size * 2.0f / std::sqrt((float)std::max<uint64_t>(current.num_points, 1));
+		}
+		if (header.flags & HIERARCHY_FLAG_COLORS) {
+			current.has_colors = true;
+			memcpy(current.color_min, record, sizeof(current.color_min));
+			memcpy(current.color_max, record + sizeof(current.color_min), sizeof(current.color_max));
+		}
+		cursor += stats_size;
+
+		OctreeNode node = nodes[index];
+		node.first_child = (uint32_t)nodes.size();
+		node.num_child_nodes = 0;
+		for (int i = 0; i < 8; i++) {
+			if (!(node.child_nodes_mask & (1 << i))) continue;
+			OctreeNode child;
+			child.id = node.id + std::to_string(i);
+			child.level = node.level + 1;
+			child.bounds = node.bounds.get_octant(i);
+			nodes.push_back(child);
+			node.num_child_nodes++;
+		}
+		nodes[index].first_child = node.first_child;
+		nodes[index].num_child_nodes = node.num_child_nodes;
+
+		for (uint32_t i = 0; i < node.num_child_nodes; i++) parse(node.first_child + i);
+	};
+	parse(0);
+}
+
+float OctreeReader::get_projected_error(const OctreeNode& node, const OctreeQuery& query) const {
+	if (!query.use_camera) return node.spacing;
+
+	// Distance from the camera to the closest point of the tight bounds
+	const Bounds& b = node.tight_bounds;
+	float dx = std::max({ b.min_x - query.camera_x, 0.0f, query.camera_x - b.max_x });
+	float dy = std::max({ b.min_y - query.camera_y, 0.0f, query.camera_y - b.max_y });
+	float dz = std::max({ b.min_z - query.camera_z, 0.0f, query.camera_z - b.max_z });
+	float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+	if (distance <= 0.0f) return std::numeric_limits<float>::max(); // The camera is inside the node
+
+	float pixels_per_unit = query.screen_height / (2.0f * std::tan(query.fov_y / 2.0f));
+	return node.spacing / distance * pixels_per_unit;
+}
+
+bool OctreeReader::intersects(const OctreeNode& node, const OctreeQuery& query) const {
+	if (query.use_box && !box_intersects(query.box, node.tight_bounds)) return false;
+	if (query.use_frustum && !query.frustum.intersects(node.tight_bounds)) return false;
+	return true;
+}
+
+std::vector<uint32_t> OctreeReader::select_nodes(const OctreeQuery& query) const {
+	std::vector<uint32_t> selected;
+	std::priority_queue<std::pair<float, uint32_t>> queue;
+	if (intersects(nodes[0], query)) queue.push({ get_projected_error(nodes[0], query), 0 });
+
+	uint64_t num_points = 0;
+	while (!queue.empty()) {
+		auto [error, index] = queue.top();
+		queue.pop();
+		const OctreeNode& node = nodes[index];
+		if (num_points + node.num_points > query.point_budget) break;
+
+		selected.push_back(index);
+		num_points += node.num_points;
+
+		if (query.use_camera && error <= query.max_error) continue;
+		for (uint32_t i = 0; i < node.num_child_nodes; i++) {
+			const OctreeNode& child = nodes[node.first_child + i];
+			if (intersects(child, query)) queue.push({ get_projected_error(child, query), node.first_child + i });
+		}
+	}
+	return selected;
+}
+
+NodeCache::Points OctreeReader::load_node(uint32_t node) {
+	return cache.get(node, [this, node]() {
+		std::shared_ptr<std::vector<Point>> points = std::make_shared<std::vector<Point>>(nodes[node].num_points);
+		FILE* file = fopen(get_full_point_file(nodes[node].id, output_path).c_str(), "rb");
+		if (!file) THROW_FILE_OPEN_ERROR;
+		uint64_t read = fread(points->data(), sizeof(struct Point), points->size(), file);
+		fclose(file);
+		if (read != points->size()) throw std::runtime_error("Unexpected end of point file");
+		return NodeCache::Points(points);
+	});
+}
+
+void OctreeReader::query_points(const OctreeQuery& query, const std::function<void(const OctreeNode&, const Point*, uint64_t)>& callback) {
+	std::vector<uint32_t> selected = select_nodes(query);
+
+	if (query.skip_refined) {
+		std::vector<uint8_t> is_selected(nodes.size(), 0);
+		for (uint32_t i : selected) is_selected[i] = 1;
+		auto is_refined = [&](uint32_t index) {
+			const OctreeNode& node = nodes[index];
+			if (node.num_child_nodes == 0) return false;
+			for (uint32_t c = node.first_child; c < node.first_child + node.num_child_nodes; c++) {
+				if (!is_selected[c] && intersects(nodes[c], query)) return false;
+			}
+			return true;
+		};
+		selected.erase(std::remove_if(selected.begin(), selected.end(), is_refined), selected.end());
+	}
+	std::atomic<size_t> next = 0;
+
+	auto work = [&]() {
+		std::vector<Point> matching;
+		size_t i;
+		while ((i = next++) < selected.size()) {
+			const OctreeNode& node = nodes[selected[i]];
+			NodeCache::Points points = load_node(selected[i]);
+			if (!query.use_box && !query.use_frustum) {
+				callback(node, points->data(), points->size());
+				continue;
+			}
+			matching.clear();
+			for (const Point& p : *points) {
+				if (query.use_box && !box_contains(query.box, p)) continue;
+				if (query.use_frustum && !query.frustum.contains(p)) continue;
+				matching.push_back(p);
+			}
+			callback(node, matching.data(), matching.size());
+		}
+	};
+
+	std::vector<std::future<void>> futures;
+	uint32_t threads = (uint32_t)std::min<size_t>(num_threads, selected.size());
+	for (uint32_t t = 1; t < threads; t++) futures.push_back(std::async(std::launch::async, work));
+	std::exception_ptr error;
+	try {
+		work();
+	}
+	catch (...) {
+		error = std::current_exception();
+	}
+	for (auto& f : futures) {
+		try {
+			f.get();
+		}
+		catch (...) {
+			if (!error) error = std::current_exception();
+		}
+	}
+	if (error) std::rethrow_exception(error);
+}
+
+std::vector<Point> OctreeReader::query_points(const OctreeQuery& query) {
+	std::vector<Point> result;
+	std::mutex result_lock;
+	query_points(query, [&](const OctreeNode&, const Point* points, uint64_t n) {
+		std::lock_guard<std::mutex> guard(result_lock);
+		result.insert(result.end(), points, points + n);
+	});
+	return result;
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <future>
+#include <functional>
+#include "Data.h"
+
+// Node of an octree that was read back from the converter output. Children are stored
+// next to each other, first_child is the index of the first one in the node list.
+struct OctreeNode {
+	std::string id;
+	Cube bounds;
+	// Bounds of the points of the subtree and average distance between the points of the node.
+	// Hierarchies of version 1 have no statistics, the cube and an estimate are used instead.
+	Bounds tight_bounds;
+	float spacing;
+	bool has_colors = false;
+	uint16_t color_min[3] = { 0, 0, 0 };
+	uint16_t color_max[3] = { 0, 0, 0 };
+	uint64_t num_points;
+	uint8_t child_nodes_mask;
+	uint8_t level;
+	uint32_t first_child;
+	uint32_t num_child_nodes;
+};
+
+// View frustum given by six planes (a, b, c, d), a point is inside if a*x + b*y + c*z + d >= 0 for all of them
+struct Frustum {
+	float planes[6][4];
+
+	// Extract the planes from a column-major view-projection matrix (OpenGL convention)
+	static Frustum from_matrix(const float m[16]);
+
+	bool intersects(const Cube& cube) const;
+	bool intersects(const Bounds& bounds) const;
+	bool contains(const Point& p) const;
+};
+
+struct OctreeQuery {
+	// Only nodes and points inside the box are returned
+	bool use_box = false;
+	Bounds box;
+
+	// Only nodes and points inside the frustum are returned
+	bool use_frustum = false;
+	Frustum frustum;
+
+	// Screen-space error LOD: with a camera, nodes are refined while their point spacing
+	// projects to more than max_error pixels. Without one every node is refined.
+	bool use_camera = false;
+	float camera_x = 0.0f, camera_y = 0.0f, camera_z = 0.0f;
+	float fov_y = 1.0f; // Vertical field of view in radians
+	float screen_height = 1080.0f;
+	float max_error = 1.0f;
+
+	// Stop refining once this many points are selected
+	uint64_t point_budget = UINT64_MAX;
+
+	// In octrees built with redundant sampling the points of an inner node are copies of
+	// points of its children. Skip the points of nodes whose children were all selected,
+	// so every point is returned once.
+	bool skip_refined = false;
+};
+
+// Bounded LRU cache of node payloads, shared by the threads that load them. A node that is
+// requested while another thread loads it waits for that load instead of reading it again.
+class NodeCache {
+public:
+	typedef std::shared_ptr<const std::vector<Point>> Points;
+
+private:
+	struct Entry {
+		std::shared_future<Points> points;
+		uint64_t bytes;
+		std::list<uint32_t>::iterator lru;
+	};
+
+	std::mutex lock;
+	std::unordered_map<uint32_t, Entry> entries;
+	std::list<uint32_t> lru; // Most recently used first
+	uint64_t capacity;
+	uint64_t bytes = 0;
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+
+	void evict();
+
+public:
+	NodeCache(uint64_t capacity_bytes) : capacity(capacity_bytes) {}
+
+	Points get(uint32_t node, const std::function<Points()>& load);
+	// The cached points of a node, nullptr if it is not cached or still loading
+	Points find(uint32_t node);
+	uint64_t get_hits();
+	uint64_t get_misses();
+};
+
+// Reads the output of the converter: hierarchy.bin is mapped into memory once, node
+// payloads (p<id>.bin) are loaded on demand through a node cache.
+class OctreeReader {
+private:
+	std::string output_path;
+	std::vector<OctreeNode> nodes;
+	NodeCache cache;
+	uint32_t num_threads;
+
+	void parse_hierarchy(const uint8_t* data, uint64_t size);
+	float get_projected_error(const OctreeNode& node, const OctreeQuery& query) const;
+	bool intersects(const OctreeNode& node, const OctreeQuery& query) const;
+
+public:
+	// cache_bytes bounds the memory used by cached payloads, num_threads loads payloads in parallel (0 for all cores)
+	OctreeReader(const std::string& output_path, uint64_t cache_bytes = 1ull << 30, uint32_t num_threads = 0);
+
+	const std::vector<OctreeNode>& get_nodes() const { return nodes; }
+	const OctreeNode& get_root() const { return nodes[0]; }
+
+	// Select the nodes for a query, coarse nodes with the largest error are refined first
+	std::vector<uint32_t> select_nodes(const OctreeQuery& query) const;
+
+	NodeCache::Points load_node(uint32_t node);
+
+	// Load the selected nodes in parallel and pass the points that match the query to
+	// callback, which is called from the loading threads (one node at a time per thread)
+	void query_points(const OctreeQuery& query, const std::function<void(const OctreeNode&, const Point*, uint64_t)>& callback);
+	// Collect the matching points of a query
+	std::vector<Point> query_points(const OctreeQuery& query);
+
+	NodeCache& get_cache() { return cache; }
+};
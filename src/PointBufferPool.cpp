@@ -0,0 +1,128 @@
+#include "PointBufferPool.h"
+#include <new>
+#include <string>
+#include "Logger.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Smaller buffers are left to the heap
+#define POOL_MIN_BUFFER_BYTES (64 * 1024)
+// Buffers from this size on get their own mapping
+#define POOL_HUGE_PAGE_BYTES (2 * 1024 * 1024)
+// Released buffers beyond this are given back to the system right away
+#define POOL_MAX_CACHED_BYTES (1ull << 30)
+
+PointBufferPool& PointBufferPool::get() {
+	static PointBufferPool* pool = new PointBufferPool();
+	return *pool;
+}
+
+void PointBufferPool::set_huge_pages(HugePages mode) {
+	std::lock_guard<std::mutex> guard(lock);
+	huge_pages = mode;
+}
+
+// Classes are 5, 6, 7 and 8 times a power of two, the index counts them from the smallest
+int PointBufferPool::get_size_class(uint64_t bytes) {
+	uint32_t shift = 0;
+	while (((bytes - 1) >> shift) >= 8) shift++;
+	return (int)(shift * 4 + ((bytes - 1) >> shift) - 4);
+}
+
+uint64_t PointBufferPool::get_class_bytes(int size_class) {
+	uint64_t bytes = (uint64_t)(size_class % 4 + 5) << (size_class / 4);
+	// Mappings are whole huge pages, so reserved huge pages can be unmapped again
+	if (bytes >= POOL_HUGE_PAGE_BYTES) bytes = (bytes + POOL_HUGE_PAGE_BYTES - 1) / POOL_HUGE_PAGE_BYTES * POOL_HUGE_PAGE_BYTES;
+	return bytes;
+}
+
+void* PointBufferPool::allocate_pages(uint64_t bytes, HugePages huge_pages) {
+#ifdef __linux__
+	if (bytes >= POOL_HUGE_PAGE_BYTES) {
+		void* p = MAP_FAILED;
+		if (huge_pages == HugePages::HUGETLB) {
+			p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		}
+		if (p == MAP_FAILED) {
+			p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED) throw std::bad_alloc();
+			if (huge_pages != HugePages::OFF) madvise(p, bytes, MADV_HUGEPAGE);
+		}
+		return p;
+	}
+#endif
+	return ::operator new(bytes);
+}
+
+void PointBufferPool::free_pages(void* p, uint64_t bytes) {
+#ifdef __linux__
+	if (bytes >= POOL_HUGE_PAGE_BYTES) {
+		munmap(p, bytes);
+		return;
+	}
+#endif
+	::operator delete(p);
+}
+
+void* PointBufferPool::acquire(uint64_t bytes) {
+	if (bytes < POOL_MIN_BUFFER_BYTES) return ::operator new(bytes);
+	int size_class = get_size_class(bytes);
+	uint64_t class_bytes = get_class_bytes(size_class);
+
+	HugePages mode;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		bytes_in_use += class_bytes;
+		if (bytes_in_use > peak_bytes_in_use) peak_bytes_in_use = bytes_in_use;
+		if (!free_buffers[size_class].empty()) {
+			void* p = free_buffers[size_class].back();
+			free_buffers[size_class].pop_back();
+			bytes_cached -= class_bytes;
+			hits++;
+			return p;
+		}
+		misses++;
+		if (bytes_in_use + bytes_cached > peak_bytes_reserved) peak_bytes_reserved = bytes_in_use + bytes_cached;
+		mode = huge_pages;
+	}
+	return allocate_pages(class_bytes, mode);
+}
+
+void PointBufferPool::release(void* p, uint64_t bytes) {
+	if (bytes < POOL_MIN_BUFFER_BYTES) {
+		::operator delete(p);
+		return;
+	}
+	int size_class = get_size_class(bytes);
+	uint64_t class_bytes = get_class_bytes(size_class);
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		bytes_in_use -= class_bytes;
+		if (bytes_cached + class_bytes <= POOL_MAX_CACHED_BYTES) {
+			free_buffers[size_class].push_back(p);
+			bytes_cached += class_bytes;
+			return;
+		}
+	}
+	free_pages(p, class_bytes);
+}
+
+void PointBufferPool::trim() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (int c = 0; c < NUM_SIZE_CLASSES; c++) {
+		for (void* p : free_buffers[c]) free_pages(p, get_class_bytes(c));
+		free_buffers[c].clear();
+	}
+	bytes_cached = 0;
+}
+
+void PointBufferPool::log_stats() {
+	std::lock_guard<std::mutex> guard(lock);
+	uint64_t requests = hits + misses;
+	if (requests == 0) return;
+	Logger::log_info("Point buffers: " + std::to_string(hits * 100 / requests) + "% pool hits (" + std::to_string(hits)
+		+ " of " + std::to_string(requests) + "), peak " + std::to_string(peak_bytes_in_use >> 20) + " MB in use, "
+		+ std::to_string(peak_bytes_reserved >> 20) + " MB reserved");
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Recycles the large buffers that hold the points of nodes while they are split in-core.
+// Requests are rounded up to size classes (four per power of two, so at most 25% larger
+// than requested) and released buffers are kept per class for the next request of that
+// class. Buffers of 2 MB or more are mapped separately and backed by huge pages if possible.
+class PointBufferPool {
+public:
+	enum class HugePages {
+		OFF,
+		THP, // Ask for transparent huge pages (madvise)
+		HUGETLB, // Use reserved huge pages, transparent ones if there are none left
+	};
+
+private:
+	static const int NUM_SIZE_CLASSES = 256;
+
+	std::mutex lock;
+	std::vector<void*> free_buffers[NUM_SIZE_CLASSES];
+	HugePages huge_pages = HugePages::THP;
+
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t bytes_in_use = 0;
+	uint64_t bytes_cached = 0;
+	uint64_t peak_bytes_in_use = 0;
+	uint64_t peak_bytes_reserved = 0;
+
+	static int get_size_class(uint64_t bytes);
+	static uint64_t get_class_bytes(int size_class);
+	static void* allocate_pages(uint64_t bytes, HugePages huge_pages);
+	static void free_pages(void* p, uint64_t bytes);
+
+public:
+	// The pool of the process, it lives until exit so vectors can be freed at any time
+	static PointBufferPool& get();
+
+	void set_huge_pages(HugePages mode);
+
+	void* acquire(uint64_t bytes);
+	void release(void* p, uint64_t bytes);
+	// Give all cached buffers back to the system
+	void trim();
+
+	void log_stats();
+};
+
+// Allocator that takes the buffers of a vector from the point buffer pool
+template <typename T>
+struct PointBufferAllocator {
+	typedef T value_type;
+
+	PointBufferAllocator() = default;
+	template <typename U> PointBufferAllocator(const PointBufferAllocator<U>&) {}
+
+	T* allocate(size_t n) { return (T*)PointBufferPool::get().acquire(n * sizeof(T)); }
+	void deallocate(T* p, size_t n) { PointBufferPool::get().release(p, n * sizeof(T)); }
+
+	template <typename U> bool operator==(const PointBufferAllocator<U>&) const { return true; }
+	template <typename U> bool operator!=(const PointBufferAllocator<U>&) const { return false; }
+};
@@ -4,15 +4,29 @@
 
 class PointReader {
 protected:
-	FILE* file;
-	bool eof;
+	FILE* file = nullptr;
 
 public:
 	virtual void open(std::string filename) {};
 	virtual Point read_point() { return Point(); };
-	virtual bool has_points() { return false; }; // Has to be called after read_point
+	// Read a point together with its attributes
+	virtual Point read_point(PointAttributes& attributes) {
+		attributes = PointAttributes();
+		return read_point();
+	}
+	virtual bool has_points() { return false; }; // Has to be called before read_point
+
+	// Read up to max_points points into the given arrays, returns the number of points read
+	uint64_t read_batch(Point* points, PointAttributes* attributes, uint64_t max_points) {
+		uint64_t n = 0;
+		while (n < max_points && has_points()) {
+			points[n] = read_point(attributes[n]);
+			n++;
+		}
+		return n;
+	}
 
-	~PointReader() {
-		fclose(file);
+	virtual ~PointReader() {
+		if (file) fclose(file);
 	}
-};
\ No newline at end of file
+};
@@ -1,17 +1,59 @@
 #include "RawPointReader.h"
 #include <stdexcept>
+#include <filesystem>
+#include "Utils.h"
+
+RawPointReader::~RawPointReader() {
+	for (FILE* f : attribute_files) fclose(f);
+}
 
 void RawPointReader::open(std::string filename) {
 	file = fopen(filename.c_str(), "rb");
 	if (!file) throw std::runtime_error("Could not open file");
+	num_points = std::filesystem::file_size(filename) / sizeof(struct Point);
+
+	if (schema) {
+		for (size_t i = 0; i < schema->size(); i++) {
+			FILE* f = fopen(get_attribute_file(filename, AttributeSchema::get_name(schema->get(i))).c_str(), "rb");
+			if (!f) throw std::runtime_error("Could not open attribute file");
+			attribute_files.push_back(f);
+		}
+	}
+}
+
+void RawPointReader::open(FILE* stream) {
+	file = stream;
+	is_stream = true;
+	schema = nullptr;
 }
 
 bool RawPointReader::has_points() {
-	return eof;
+	if (is_stream) {
+		if (!has_next) has_next = fread(&next, sizeof(next), 1, file) == 1;
+		return has_next;
+	}
+	return points_read < num_points;
 }
 
 Point RawPointReader::read_point() {
+	if (is_stream) {
+		if (!has_points()) throw std::runtime_error("Unexpected end of stream");
+		has_next = false;
+		points_read++;
+		return next;
+	}
 	Point p;
-	eof = fread(&p, sizeof(p), 1, file);
+	if (!fread(&p, sizeof(p), 1, file)) throw std::runtime_error("Unexpected end of file");
+	points_read++;
 	return p;
-}
\ No newline at end of file
+}
+
+Point RawPointReader::read_point(PointAttributes& attributes) {
+	attributes = PointAttributes();
+	uint8_t value[sizeof(double)];
+	for (size_t i = 0; i < attribute_files.size(); i++) {
+		if (!fread(value, AttributeSchema::get_size(schema->get(i)), 1, attribute_files[i])) throw std::runtime_error("Unexpected end of attribute file");
+		schema->decode(i, value, attributes);
+	}
+	return read_point();
+}
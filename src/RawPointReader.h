@@ -1,8 +1,29 @@
 #pragma once
+#include <vector>
 #include "PointReader.h"
+#include "AttributeSchema.h"
 
 class RawPointReader : public PointReader {
+	uint64_t num_points = 0;
+	uint64_t points_read = 0;
+
+	// Streams have no known length, the next point is read ahead to find their end
+	bool is_stream = false;
+	bool has_next = false;
+	Point next;
+
+	// Attribute columns that belong to the point file, if any
+	const AttributeSchema* schema;
+	std::vector<FILE*> attribute_files;
+
+public:
+	RawPointReader(const AttributeSchema* schema = nullptr) : schema(schema) {}
+	~RawPointReader();
+
 	void open(std::string filename) override;
+	// Read points from an already open stream such as stdin, without attribute columns
+	void open(FILE* stream);
 	bool has_points() override;
 	Point read_point() override;
-};
\ No newline at end of file
+	Point read_point(PointAttributes& attributes) override;
+};
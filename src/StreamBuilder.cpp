@@ -0,0 +1,301 @@
+#include "StreamBuilder.h"
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include "Logger.h"
+#include "NodeFile.h"
+#include "HierarchyWriter.h"
+#include "Utils.h"
+
+// Buckets are created at this depth below the current root, re-rooting moves existing buckets deeper
+#define STREAM_BUCKET_DEPTH 2
+// Points buffered per bucket before they are appended to its spill file
+#define STREAM_BUFFER_POINTS (1 << 15)
+#define STREAM_BATCH_SIZE (1 << 16)
+// Smallest edge length of the initial root cube, for streams that start with a single point
+#define STREAM_MIN_EXTENT (1.0 / 1024.0)
+
+StreamBuilder::StreamBuilder(const std::string& output_path, uint32_t max_node_size, uint32_t sampled_node_size,
+	IngestFilter* filter, BuildOptions options) {
+	this->output_path = output_path;
+	this->max_node_size = max_node_size;
+	this->sampled_node_size = sampled_node_size;
+	this->filter = filter;
+	this->options = options;
+}
+
+StreamBuilder::~StreamBuilder() {
+	if (root) delete_stream_nodes(root);
+}
+
+// The edge length is a power of two and the cube starts on a multiple of it, so doubling
+// the root reproduces the cubes of the old nodes exactly
+Cube StreamBuilder::get_initial_cube(const Bounds& bounds) {
+	double extent = std::max({ (double)bounds.max_x - bounds.min_x, (double)bounds.max_y - bounds.min_y,
+		(double)bounds.max_z - bounds.min_z, STREAM_MIN_EXTENT });
+	double edge = std::exp2(std::ceil(std::log2(extent)));
+
+	// Along every axis the bounds overlap at most two cells of a grid with this edge length
+	Cube cube;
+	cube.center_x = (float)(std::floor(bounds.min_x / edge) * edge + edge);
+	cube.center_y = (float)(std::floor(bounds.min_y / edge) * edge + edge);
+	cube.center_z = (float)(std::floor(bounds.min_z / edge) * edge + edge);
+	cube.size = (float)edge;
+	return cube;
+}
+
+bool StreamBuilder::contains(const Cube& cube, const Point& p) {
+	return p.x >= cube.center_x - cube.size && p.x <= cube.center_x + cube.size
+		&& p.y >= cube.center_y - cube.size && p.y <= cube.center_y + cube.size
+		&& p.z >= cube.center_z - cube.size && p.z <= cube.center_z + cube.size;
+}
+
+void StreamBuilder::grow_root(const Point& p) {
+	while (!contains(root->bounds, p)) {
+		// Double the root towards the point, the old root is the octant facing away from it
+		Cube bounds = root->bounds;
+		uint8_t index = 0;
+		if (p.x < bounds.center_x) { index |= (1 << 2); bounds.center_x -= bounds.size; }
+		else bounds.center_x += bounds.size;
+		if (p.y < bounds.center_y) { index |= (1 << 1); bounds.center_y -= bounds.size; }
+		else bounds.center_y += bounds.size;
+		if (p.z < bounds.center_z) { index |= (1 << 0); bounds.center_z -= bounds.size; }
+		else bounds.center_z += bounds.size;
+		bounds.size *= 2.0f;
+
+		StreamNode* new_root = new StreamNode();
+		new_root->bounds = bounds;
+		new_root->children[index] = root;
+		root = new_root;
+		num_reroots++;
+	}
+}
+
+StreamBuilder::StreamNode* StreamBuilder::create_child(StreamNode* node, uint8_t i, bool is_bucket) {
+	StreamNode* child = new StreamNode();
+	child->bounds.center_x = node->bounds.center_x + (-(node->bounds.size / 2.0f) + ((i & (1 << 2)) ? node->bounds.size : 0));
+	child->bounds.center_y = node->bounds.center_y + (-(node->bounds.size / 2.0f) + ((i & (1 << 1)) ? node->bounds.size : 0));
+	child->bounds.center_z = node->bounds.center_z + (-(node->bounds.size / 2.0f) + ((i & (1 << 0)) ? node->bounds.size : 0));
+	child->bounds.size = node->bounds.size / 2.0f;
+	child->is_bucket = is_bucket;
+	if (is_bucket) child->file_index = num_buckets++;
+	node->children[i] = child;
+	return child;
+}
+
+void StreamBuilder::add(const Point& p, const PointAttributes& a) {
+	if (!contains(root->bounds, p)) {
+		// The root could never grow large enough for these
+		if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) throw std::runtime_error("Invalid point coordinates in the input stream");
+		grow_root(p);
+	}
+
+	StreamNode* node = root;
+	uint32_t depth = 0;
+	while (!node->is_bucket) {
+		uint8_t index = 0;
+		if (p.x > node->bounds.center_x) index |= (1 << 2);
+		if (p.y > node->bounds.center_y) index |= (1 << 1);
+		if (p.z > node->bounds.center_z) index |= (1 << 0);
+		depth++;
+		node = node->children[index] ? node->children[index] : create_child(node, index, depth >= STREAM_BUCKET_DEPTH);
+	}
+
+	node->points.push_back(p);
+	if (!options.attributes.empty()) node->attributes.push_back(a);
+	if (node->points.size() >= STREAM_BUFFER_POINTS) flush(node);
+}
+
+void StreamBuilder::flush(StreamNode* node) {
+	if (node->points.empty()) return;
+	NodeFileWriter writer(get_stream_point_file(node->file_index, output_path), options.attributes, true);
+	writer.write(node->points.data(), node->attributes.data(), node->points.size());
+	node->num_points += node->points.size();
+	node->points.clear();
+	node->attributes.clear();
+}
+
+void StreamBuilder::flush_all(StreamNode* node) {
+	if (node->is_bucket) {
+		flush(node);
+		std::vector<Point>().swap(node->points);
+		std::vector<PointAttributes>().swap(node->attributes);
+		return;
+	}
+	for (StreamNode* child : node->children) {
+		if (child) flush_all(child);
+	}
+}
+
+// Turn subtrees that hold no more than max_node_size points into a single bucket, so sparse
+// regions end in one leaf instead of a few tiny ones. Returns the number of points of the subtree.
+uint64_t StreamBuilder::merge_small_subtrees(StreamNode* node) {
+	if (node->is_bucket) return node->num_points;
+
+	uint64_t total = 0;
+	for (StreamNode* child : node->children) {
+		if (child) total += merge_small_subtrees(child);
+	}
+	if (total > max_node_size) return total;
+
+	uint32_t index = num_buckets++;
+	{
+		NodeFileWriter writer(get_stream_point_file(index, output_path), options.attributes);
+		merge_into(node, writer);
+	}
+	node->is_bucket = true;
+	node->file_index = index;
+	node->num_points = total;
+	return total;
+}
+
+void StreamBuilder::merge_into(StreamNode* node, NodeFileWriter& writer) {
+	for (StreamNode*& child : node->children) {
+		if (!child) continue;
+		if (child->is_bucket) {
+			std::string point_file = get_stream_point_file(child->file_index, output_path);
+			PointBuffer points;
+			AttributeColumns attributes;
+			read_node_file(point_file, options.attributes, child->num_points, points, attributes);
+			writer.write(points, attributes);
+			remove_node_file(point_file, options.attributes);
+		}
+		else {
+			merge_into(child, writer);
+		}
+		delete child;
+		child = nullptr;
+	}
+}
+
+// Build the node hierarchy now that the ids are fixed and move the spill files of the buckets
+// to the point files of their nodes. Inner nodes are collected children first.
+Node* StreamBuilder::create_nodes(StreamNode* stream_node, const std::string& id, std::vector<Node*>& buckets, std::vector<Node*>& inner_nodes) {
+	Node* node = new Node();
+	node->id = id;
+	node->bounds = stream_node->bounds;
+	node->child_nodes_mask = 0;
+	node->num_points = stream_node->num_points;
+
+	if (stream_node->is_bucket) {
+		rename_node_file(get_stream_point_file(stream_node->file_index, output_path), get_full_point_file(id, output_path), options.attributes);
+		buckets.push_back(node);
+		return node;
+	}
+
+	node->child_nodes = new Node*[8];
+	for (int i = 0; i < 8; i++) {
+		if (stream_node->children[i]) {
+			node->child_nodes[i] = create_nodes(stream_node->children[i], id + std::to_string(i), buckets, inner_nodes);
+			node->child_nodes_mask |= (1 << i);
+		}
+	}
+	inner_nodes.push_back(node);
+	return node;
+}
+
+void StreamBuilder::delete_stream_nodes(StreamNode* node) {
+	for (StreamNode* child : node->children) {
+		if (child) delete_stream_nodes(child);
+	}
+	delete node;
+}
+
+void StreamBuilder::add_input_batch(std::shared_ptr<const PointBatch> batch) {
+	input_batches.push_back(batch);
+}
+
+void StreamBuilder::stream(PointReader& reader, uint64_t& num_points, uint64_t& points_read, Bounds* input_bounds) {
+	std::vector<Point> points(STREAM_BATCH_SIZE);
+	std::vector<PointAttributes> attributes(STREAM_BATCH_SIZE);
+	bool use_filter = filter && filter->is_active();
+
+	// Partition the points while they arrive, the text reader parses the next window meanwhile
+	auto last_log = std::chrono::steady_clock::now();
+	uint64_t n;
+	while ((n = reader.read_batch(points.data(), attributes.data(), STREAM_BATCH_SIZE)) > 0) {
+		points_read += n;
+		if (input_bounds) {
+			for (uint64_t i = 0; i < n; i++) input_bounds->add(points[i]);
+		}
+		if (use_filter) n = filter->apply(points.data(), attributes.data(), n);
+		if (n == 0) continue;
+
+		if (!root) {
+			Bounds bounds;
+			for (uint64_t i = 0; i < n; i++) bounds.add(points[i]);
+			root = new StreamNode();
+			root->bounds = get_initial_cube(bounds);
+		}
+		for (uint64_t i = 0; i < n; i++) add(points[i], attributes[i]);
+		num_points += n;
+
+		auto now = std::chrono::steady_clock::now();
+		if (now - last_log >= std::chrono::seconds(1)) {
+			last_log = now;
+			// The total is unknown while streaming, a progress callback only hears from the split
+			if (!options.progress) Logger::log_return("Streamed " + std::to_string(num_points) + " points [Buckets: " + std::to_string(num_buckets)
+				+ "; Re-rooted: " + std::to_string(num_reroots) + "]                 \r");
+		}
+	}
+}
+
+Node* StreamBuilder::build(PointReader& reader, uint64_t& num_points) {
+	uint64_t points_read = 0;
+	num_points = 0;
+	stream(reader, num_points, points_read, nullptr);
+	return finish(num_points, points_read);
+}
+
+Node* StreamBuilder::build(const std::vector<std::string>& input_files, InputManifest* manifest, uint64_t& num_points) {
+	uint64_t points_read = 0;
+	num_points = 0;
+	for (const std::string& file : input_files) {
+		if (input_files.size() > 1) Logger::log_info("Reading '" + std::filesystem::path(file).filename().string() + "'");
+		std::unique_ptr<PointReader> reader = Builder::open_input_reader(file, manifest, options.compute_threads);
+		bool is_text = get_point_file_format(file) == POINT_FILE_FORMAT_PTS;
+		Bounds bounds;
+		uint64_t read_before = points_read;
+		stream(*reader, num_points, points_read, is_text ? &bounds : nullptr);
+		if (is_text && manifest) manifest->add_scanned(file, points_read - read_before, bounds);
+	}
+	for (auto& batch : input_batches) {
+		MemoryPointReader reader(batch);
+		stream(reader, num_points, points_read, nullptr);
+	}
+	return finish(num_points, points_read);
+}
+
+Node* StreamBuilder::finish(uint64_t num_points, uint64_t points_read) {
+	if (!root) throw std::runtime_error("No points in the input stream");
+
+	if (filter && filter->is_active()) Logger::log_info("Kept " + std::to_string(num_points) + " of " + std::to_string(points_read) + " points");
+	else Logger::log_info("Streamed " + std::to_string(num_points) + " points                                        ");
+	Logger::log_info("Bounds: " + root->bounds.to_string() + " (re-rooted " + std::to_string(num_reroots) + " times)");
+
+	flush_all(root);
+	merge_small_subtrees(root);
+
+	std::vector<Node*> buckets;
+	std::vector<Node*> inner_nodes;
+	Node* root_node = create_nodes(root, "", buckets, inner_nodes);
+	delete_stream_nodes(root);
+	root = nullptr;
+
+	// The buckets are split like any other node, the points were filtered already
+	Builder builder(root_node->bounds, num_points, output_path, max_node_size, sampled_node_size,
+		std::vector<std::string>(), nullptr, nullptr, options);
+	Logger::log_info("Building " + std::to_string(buckets.size()) + " subtrees...");
+	try {
+		builder.build_subtrees(buckets);
+		for (Node* node : inner_nodes) builder.sample_from_children(node);
+	}
+	catch (...) {
+		delete_hierarchy(root_node);
+		throw;
+	}
+	Logger::log_info("Done building                                              ");
+
+	return root_node;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Data.h"
+#include "Builder.h"
+#include "IngestFilter.h"
+#include "PointReader.h"
+#include "MemoryPointReader.h"
+#include "InputManifest.h"
+
+// Builds an octree from a stream of points whose count and bounds are not known before
+// it ends, e.g. points piped into stdin by a decoder. The root cube is taken from the first
+// batch and doubled towards every point that falls outside of it, the old root becoming
+// one of the octants of the new one. Points are partitioned into buckets a few levels
+// below the root while they arrive and spilled to disk in blocks. Once the stream ends,
+// the subtrees below the buckets are built like any other node and the levels above them
+// are sampled from their children.
+//
+// Input files whose bounds are not known yet (text files) are built this way as well, so they
+// are read only once instead of once for their bounds and once more to split the root.
+class StreamBuilder {
+private:
+	struct StreamNode {
+		Cube bounds;
+		StreamNode* children[8] = {};
+		bool is_bucket = false;
+		uint32_t file_index = 0;
+		uint64_t num_points = 0; // Points in the spill file
+		// Points that are not spilled yet
+		std::vector<Point> points;
+		std::vector<PointAttributes> attributes;
+	};
+
+	std::string output_path;
+	uint32_t max_node_size;
+	uint32_t sampled_node_size;
+	IngestFilter* filter;
+	BuildOptions options;
+
+	std::vector<std::shared_ptr<const PointBatch>> input_batches;
+
+	StreamNode* root = nullptr;
+	uint32_t num_buckets = 0;
+	uint32_t num_reroots = 0;
+
+	static Cube get_initial_cube(const Bounds& bounds);
+	static bool contains(const Cube& cube, const Point& p);
+
+	void grow_root(const Point& p);
+	StreamNode* create_child(StreamNode* node, uint8_t index, bool is_bucket);
+	void add(const Point& p, const PointAttributes& a);
+	void flush(StreamNode* node);
+	void flush_all(StreamNode* node);
+	uint64_t merge_small_subtrees(StreamNode* node);
+	void merge_into(StreamNode* node, NodeFileWriter& writer);
+	Node* create_nodes(StreamNode* node, const std::string& id, std::vector<Node*>& buckets, std::vector<Node*>& inner_nodes);
+	void delete_stream_nodes(StreamNode* node);
+
+	// Partition the points of a reader, input_bounds (if set) gets the bounds before filtering
+	void stream(PointReader& reader, uint64_t& num_points, uint64_t& points_read, Bounds* input_bounds);
+	// Build the subtrees below the buckets and the levels above them
+	Node* finish(uint64_t num_points, uint64_t points_read);
+
+public:
+	StreamBuilder(const std::string& output_path, uint32_t max_node_size, uint32_t sampled_node_size,
+		IngestFilter* filter = nullptr, BuildOptions options = BuildOptions());
+	~StreamBuilder();
+
+	// Points to read after the input files
+	void add_input_batch(std::shared_ptr<const PointBatch> batch);
+
+	// Read the reader until it has no points left and build the octree. Returns the root,
+	// num_points is set to the number of points that were kept.
+	Node* build(PointReader& reader, uint64_t& num_points);
+	// Read the input files one after the other and then the batches, and build the octree. The
+	// point count and bounds of every text file are entered into the manifest (if any), so later
+	// runs know them up front.
+	Node* build(const std::vector<std::string>& input_files, InputManifest* manifest, uint64_t& num_points);
+};
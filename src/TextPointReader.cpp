@@ -0,0 +1,169 @@
+#include "TextPointReader.h"
+#include <charconv>
+#include <stdexcept>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+#include "ThreadTuning.h"
+
+#define TEXT_WINDOW_SIZE (32 * 1024 * 1024)
+#define TEXT_MIN_CHUNK_SIZE (256 * 1024)
+
+static inline bool is_separator(char c) {
+	return c == ' ' || c == '\t' || c == ',' || c == ';' || c == '\r';
+}
+
+void TextPointReader::parse_chunk(const char* begin, const char* end, double intensity_offset, Batch& batch) {
+	// Roughly 40 characters per line
+	batch.points.reserve((end - begin) / 40);
+	batch.intensities.reserve((end - begin) / 40);
+
+	const char* c = begin;
+	while (c < end) {
+		const char* line_end = std::find(c, end, '\n');
+
+		double values[7];
+		int num_values = 0;
+		while (c < line_end && num_values < 7) {
+			while (c < line_end && is_separator(*c)) c++;
+			if (c == line_end) break;
+			if (*c == '+') c++; // from_chars does not accept a leading plus
+			auto result = std::from_chars(c, line_end, values[num_values]);
+			if (result.ec != std::errc()) break;
+			c = result.ptr;
+			num_values++;
+		}
+		c = line_end + 1;
+
+		if (num_values < 3) continue;
+
+		Point p;
+		p.x = (float)values[0];
+		p.y = (float)values[1];
+		p.z = (float)values[2];
+		p.r = p.g = p.b = 0;
+		if (num_values >= 6) {
+			// x y z r g b or x y z i r g b, colors are stored with 16 bits like in LAS
+			int first = num_values == 6 ? 3 : 4;
+			p.r = (uint16_t)(std::clamp(values[first], 0.0, 255.0) * 257.0);
+			p.g = (uint16_t)(std::clamp(values[first + 1], 0.0, 255.0) * 257.0);
+			p.b = (uint16_t)(std::clamp(values[first + 2], 0.0, 255.0) * 257.0);
+		}
+		batch.points.push_back(p);
+		bool has_intensity = num_values == 4 || num_values == 7;
+		batch.intensities.push_back(has_intensity ? (uint16_t)std::clamp(values[3] + intensity_offset, 0.0, 65535.0) : 0);
+
+		batch.bounds.add(p);
+	}
+}
+
+TextPointReader::Batch TextPointReader::read_window() {
+	std::vector<char> buffer(remainder.begin(), remainder.end());
+	size_t offset = buffer.size();
+	buffer.resize(offset + TEXT_WINDOW_SIZE);
+	size_t read = fread(buffer.data() + offset, 1, TEXT_WINDOW_SIZE, file);
+	buffer.resize(offset + read);
+	if (read < TEXT_WINDOW_SIZE) file_done = true;
+
+	// Everything after the last newline belongs to the next window
+	size_t end = buffer.size();
+	remainder.clear();
+	if (!file_done) {
+		auto last_newline = std::find(buffer.rbegin(), buffer.rend(), '\n');
+		end = buffer.rend() - last_newline;
+		remainder.assign(buffer.begin() + end, buffer.end());
+	}
+
+	// Split the window into newline-aligned chunks
+	size_t num_chunks = std::max<size_t>(1, std::min<size_t>(num_threads, end / TEXT_MIN_CHUNK_SIZE));
+	std::vector<size_t> boundaries = { 0 };
+	for (size_t i = 1; i < num_chunks; i++) {
+		size_t b = std::max(boundaries.back(), i * end / num_chunks);
+		while (b < end && buffer[b] != '\n') b++;
+		boundaries.push_back(std::min(b + 1, end));
+	}
+	boundaries.push_back(end);
+
+	std::vector<Batch> chunks(num_chunks);
+	std::vector<std::future<void>> futures;
+	for (size_t i = 1; i < num_chunks; i++) {
+		futures.push_back(std::async(std::launch::async, [&, i] {
+			parse_chunk(buffer.data() + boundaries[i], buffer.data() + boundaries[i + 1], intensity_offset, chunks[i]);
+		}));
+	}
+	parse_chunk(buffer.data(), buffer.data() + boundaries[1], intensity_offset, chunks[0]);
+	for (auto& f : futures) f.get();
+
+	// Concatenate the chunks
+	Batch result;
+	result.points.swap(chunks[0].points);
+	result.intensities.swap(chunks[0].intensities);
+	result.bounds = chunks[0].bounds;
+	for (size_t i = 1; i < num_chunks; i++) {
+		result.points.insert(result.points.end(), chunks[i].points.begin(), chunks[i].points.end());
+		result.intensities.insert(result.intensities.end(), chunks[i].intensities.begin(), chunks[i].intensities.end());
+		result.bounds.merge(chunks[i].bounds);
+	}
+	return result;
+}
+
+void TextPointReader::fetch_next_batch() {
+	if (file_done) return;
+	next_batch = std::async(std::launch::async, [this] { return read_window(); });
+}
+
+void TextPointReader::open(std::string filename) {
+	file = fopen(filename.c_str(), "rb");
+	if (!file) throw std::runtime_error("Could not open file");
+	std::string extension = std::filesystem::path(filename).extension().string();
+	for (char& c : extension) c = (char)tolower(c);
+	if (extension == ".pts") intensity_offset = 2048.0;
+	open(file);
+}
+
+void TextPointReader::open(FILE* stream) {
+	file = stream;
+	if (!num_threads) num_threads = get_available_cores();
+	fetch_next_batch();
+}
+
+bool TextPointReader::has_points() {
+	// Windows can be empty if they only contain skipped lines, so keep fetching
+	while (batch_cursor >= batch.points.size()) {
+		if (!next_batch.valid()) return false;
+		batch = next_batch.get();
+		batch_cursor = 0;
+		fetch_next_batch();
+	}
+	return true;
+}
+
+Point TextPointReader::read_point() {
+	if (!has_points()) throw std::runtime_error("Unexpected end of file");
+	return batch.points[batch_cursor++];
+}
+
+Point TextPointReader::read_point(PointAttributes& attributes) {
+	if (!has_points()) throw std::runtime_error("Unexpected end of file");
+	attributes = PointAttributes();
+	attributes.intensity = batch.intensities[batch_cursor];
+	return batch.points[batch_cursor++];
+}
+
+TextPointReader::~TextPointReader() {
+	// The base class closes the file, make sure the prefetch is done with it
+	if (next_batch.valid()) next_batch.wait();
+}
+
+void TextPointReader::scan(const std::string& filename, uint64_t& num_points, Bounds& bounds, unsigned int num_threads) {
+	TextPointReader r(num_threads);
+	r.open(filename);
+	num_points = 0;
+	bounds = Bounds();
+	while (r.next_batch.valid()) {
+		Batch b = r.next_batch.get();
+		r.fetch_next_batch();
+		num_points += b.points.size();
+		bounds.merge(b.bounds);
+	}
+}
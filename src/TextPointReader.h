@@ -0,0 +1,50 @@
+#pragma once
+#include <future>
+#include <vector>
+#include "PointReader.h"
+
+// Reads ASCII point clouds (PTS, XYZ, CSV). Every line holds x, y, z and optionally
+// an intensity and/or 8 bit r, g, b values (x y z i, x y z r g b or x y z i r g b), separated
+// by spaces, tabs, commas or semicolons. Lines that do not start with three numbers (headers,
+// point counts) are skipped. Intensities of .pts files are in the Leica range of -2048 to 2047
+// and are shifted to 0 to 4095, others are clamped to the 16 bit range of LAS.
+//
+// The file is read in large windows that are split into newline-aligned chunks and
+// parsed in parallel. The next window is parsed while the current one is consumed.
+class TextPointReader : public PointReader {
+private:
+	struct Batch {
+		std::vector<Point> points;
+		std::vector<uint16_t> intensities; // One per point, 0 for lines without an intensity
+		Bounds bounds;
+	};
+
+	Batch batch;
+	uint64_t batch_cursor = 0;
+	std::future<Batch> next_batch;
+	std::string remainder; // Incomplete last line of the previous window
+	bool file_done = false;
+	unsigned int num_threads;
+	double intensity_offset = 0.0;
+
+	Batch read_window();
+	void fetch_next_batch();
+
+	static void parse_chunk(const char* begin, const char* end, double intensity_offset, Batch& batch);
+
+public:
+	// Windows are parsed by num_threads threads, 0 uses all available cores
+	TextPointReader(unsigned int num_threads = 0) : num_threads(num_threads) {}
+
+	void open(std::string filename) override;
+	// Read from an already open stream such as stdin, which is closed with the reader
+	void open(FILE* stream);
+	bool has_points() override;
+	Point read_point() override;
+	Point read_point(PointAttributes& attributes) override;
+
+	~TextPointReader();
+
+	// Parse a whole file with num_threads threads to get its point count and bounds
+	static void scan(const std::string& filename, uint64_t& num_points, Bounds& bounds, unsigned int num_threads = 0);
+};
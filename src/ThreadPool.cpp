@@ -3,7 +3,8 @@
 #include <string>
 
 void ThreadPool::spawn(const uint16_t id) {
-	threads[id] = std::async(std::launch::async, [this] {
+	threads[id] = std::async(std::launch::async, [this, id] {
+		if (thread_init) thread_init(id);
 		try {
 			while (true) {
 				jobs_lock.lock();
@@ -18,20 +19,38 @@ void ThreadPool::spawn(const uint16_t id) {
 					continue;
 				}
 
-				std::function<void()> job = jobs.front();
+				std::function<void()> job = jobs.top().function;
 				jobs.pop();
 				jobs_lock.unlock();
 
-				job();
+				update_busy(1);
+				try {
+					job();
+				}
+				catch (...) {
+					update_busy(-1);
+					throw;
+				}
+				update_busy(-1);
 			}
 		}
-		catch (std::exception exc) {
+		catch (const std::exception& exc) {
 			Logger::log_error("Error in thread: " + std::string(exc.what()));
 		}
 	});
 }
 
-ThreadPool::ThreadPool(const uint16_t num_threads) {
+void ThreadPool::update_busy(int change) {
+	std::lock_guard<std::mutex> guard(stats_lock);
+	auto now = std::chrono::steady_clock::now();
+	busy_seconds[num_busy] += std::chrono::duration<double>(now - last_change).count();
+	last_change = now;
+	num_busy += change;
+}
+
+ThreadPool::ThreadPool(const uint16_t num_threads, std::function<void(uint16_t)> thread_init) : thread_init(thread_init) {
+	busy_seconds.resize(num_threads + 1, 0.0);
+	last_change = std::chrono::steady_clock::now();
 	threads.resize(num_threads);
 	for (uint16_t i = 0; i < num_threads; i++) {
 		spawn(i);
@@ -39,6 +58,10 @@ ThreadPool::ThreadPool(const uint16_t num_threads) {
 }
 
 void ThreadPool::add_job(std::function<void()> job) {
+	add_job(job, 0);
+}
+
+void ThreadPool::add_job(std::function<void()> job, uint64_t priority) {
 	jobs_lock.lock();
 	// Some threads may have stopped, wake them up
 	for (int i = 0; i < threads.size(); i++) {
@@ -48,7 +71,7 @@ void ThreadPool::add_job(std::function<void()> job) {
 		}
 	}
 	
-	jobs.push(job);
+	jobs.push({ priority, next_sequence++, job });
 	jobs_lock.unlock();
 }
 
@@ -60,4 +83,22 @@ void ThreadPool::wait() {
 
 uint64_t ThreadPool::num_jobs() {
 	return jobs.size();
-}
\ No newline at end of file
+}
+
+void ThreadPool::reset_stats() {
+	std::lock_guard<std::mutex> guard(stats_lock);
+	std::fill(busy_seconds.begin(), busy_seconds.end(), 0.0);
+	last_change = std::chrono::steady_clock::now();
+}
+
+double ThreadPool::get_seconds_below(uint16_t n) {
+	std::lock_guard<std::mutex> guard(stats_lock);
+	// Account for the time since the last change as well
+	double current = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_change).count();
+	double seconds = 0.0;
+	for (uint16_t i = 0; i < n && i < busy_seconds.size(); i++) {
+		seconds += busy_seconds[i];
+		if (i == num_busy) seconds += current;
+	}
+	return seconds;
+}
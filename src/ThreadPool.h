@@ -2,21 +2,50 @@
 #include <queue>
 #include <future>
 #include <mutex>
+#include <atomic>
+#include <functional>
+#include <chrono>
 
 class ThreadPool
 {
 private:
+	struct Job {
+		uint64_t priority;
+		uint64_t sequence; // Jobs with the same priority run in the order they were added
+		std::function<void()> function;
+
+		bool operator<(const Job& other) const {
+			if (priority != other.priority) return priority < other.priority;
+			return sequence > other.sequence;
+		}
+	};
+
 	std::vector<std::shared_future<void>> threads;
 	std::mutex jobs_lock;
-	std::queue<std::function<void()>> jobs;
+	std::priority_queue<Job> jobs;
+	uint64_t next_sequence = 0;
 	std::atomic<bool> done;
+	std::function<void(uint16_t)> thread_init; // Called with the thread index when a thread starts
+
+	// Time spent with a given number of busy threads, for finding idle tails
+	std::mutex stats_lock;
+	uint16_t num_busy = 0;
+	std::chrono::steady_clock::time_point last_change;
+	std::vector<double> busy_seconds;
 
 	void spawn(const uint16_t id);
+	void update_busy(int change);
 
 public:
-	ThreadPool(const uint16_t num_threads);
+	ThreadPool(const uint16_t num_threads, std::function<void(uint16_t)> thread_init = nullptr);
 	void add_job(std::function<void()> job);
+	// Jobs with a higher priority are started first
+	void add_job(std::function<void()> job, uint64_t priority);
 	void wait();
 	uint64_t num_jobs();
-};
+	uint16_t num_threads() const { return (uint16_t)threads.size(); }
 
+	void reset_stats();
+	// Seconds spent with fewer than n threads busy since the last reset
+	double get_seconds_below(uint16_t n);
+};
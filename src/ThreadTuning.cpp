@@ -0,0 +1,179 @@
+#include "ThreadTuning.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+// Every probe thread writes and syncs a few blocks of the size of a small node file
+#define IO_PROBE_BLOCK_BYTES (256 * 1024)
+#define IO_PROBE_BLOCKS 4
+#define IO_PROBE_MAX_THREADS 64
+// Stop raising the concurrency once a single round takes this long
+#define IO_PROBE_MAX_SECONDS 0.25
+#define IO_DEFAULT_THREADS 4
+
+#ifdef __linux__
+// CPUs allowed by a cgroup CPU quota, 0 if there is none
+static double get_cgroup_cpu_limit() {
+	// cgroup v2, the quota of the cgroup of the process or of the root
+	std::vector<std::string> paths;
+	std::ifstream self("/proc/self/cgroup");
+	std::string line;
+	while (std::getline(self, line)) {
+		if (line.rfind("0::", 0) == 0) paths.push_back("/sys/fs/cgroup" + line.substr(3) + "/cpu.max");
+	}
+	paths.push_back("/sys/fs/cgroup/cpu.max");
+	for (const std::string& path : paths) {
+		std::ifstream file(path);
+		std::string quota;
+		double period;
+		if (file >> quota >> period) {
+			if (quota == "max" || period <= 0.0) return 0.0;
+			return std::stod(quota) / period;
+		}
+	}
+
+	// cgroup v1
+	std::ifstream quota_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+	std::ifstream period_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+	double quota, period;
+	if (quota_file >> quota && period_file >> period && quota > 0.0 && period > 0.0) return quota / period;
+	return 0.0;
+}
+
+// Parse a CPU list like "0-3,8-11"
+static std::vector<int> parse_cpu_list(const std::string& list) {
+	std::vector<int> cpus;
+	std::stringstream stream(list);
+	std::string range;
+	while (std::getline(stream, range, ',')) {
+		size_t dash = range.find('-');
+		try {
+			int first = std::stoi(range.substr(0, dash));
+			int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+			for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+		}
+		catch (const std::exception&) {}
+	}
+	return cpus;
+}
+#endif
+
+uint32_t get_available_cores() {
+	uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+#ifdef __linux__
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) cores = std::min<uint32_t>(cores, CPU_COUNT(&set));
+	double limit = get_cgroup_cpu_limit();
+	if (limit > 0.0) cores = std::min(cores, (uint32_t)std::ceil(limit));
+#endif
+	return std::max(cores, 1u);
+}
+
+#ifdef __linux__
+// Bytes per second written by n threads that each write and sync a few blocks, 0 on errors
+static double measure_write_throughput(const std::string& directory, uint16_t n) {
+	std::vector<char> block(IO_PROBE_BLOCK_BYTES, 1);
+	std::atomic<bool> failed(false);
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (uint16_t i = 0; i < n; i++) {
+		threads.emplace_back([&, i] {
+			std::string path = directory + "/ioprobe" + std::to_string(getpid()) + "_" + std::to_string(i) + ".tmp";
+			FILE* file = fopen(path.c_str(), "wb");
+			if (!file) {
+				failed = true;
+				return;
+			}
+			for (int b = 0; b < IO_PROBE_BLOCKS; b++) {
+				if (fwrite(block.data(), 1, block.size(), file) != block.size() || fflush(file) != 0 || fdatasync(fileno(file)) != 0) {
+					failed = true;
+					break;
+				}
+			}
+			fclose(file);
+			std::error_code ec;
+			std::filesystem::remove(path, ec);
+		});
+	}
+	for (auto& t : threads) t.join();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (failed || seconds <= 0.0) return 0.0;
+	return (double)n * IO_PROBE_BLOCKS * IO_PROBE_BLOCK_BYTES / seconds;
+}
+#endif
+
+uint16_t probe_io_threads(const std::string& directory) {
+	static std::mutex lock;
+	static std::map<std::string, uint16_t> results;
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = results.find(directory);
+	if (it != results.end()) return it->second;
+
+	uint16_t threads = IO_DEFAULT_THREADS;
+#ifdef __linux__
+	double best = measure_write_throughput(directory, 1);
+	if (best > 0.0) {
+		threads = 1;
+		// Double the writers while that still raises the throughput noticeably
+		for (uint16_t n = 2; n <= IO_PROBE_MAX_THREADS; n *= 2) {
+			auto start = std::chrono::steady_clock::now();
+			double throughput = measure_write_throughput(directory, n);
+			if (throughput < best * 1.2) break;
+			best = throughput;
+			threads = n;
+			if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > IO_PROBE_MAX_SECONDS) break;
+		}
+		// A second writer keeps the queue busy while the other one syncs
+		threads = std::max<uint16_t>(threads, 2);
+	}
+#endif
+	results[directory] = threads;
+	return threads;
+}
+
+std::vector<std::vector<int>> get_numa_nodes() {
+	std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+	std::error_code ec;
+	for (auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+		std::string name = entry.path().filename().string();
+		if (name.rfind("node", 0) != 0 || name.size() == 4 || !std::all_of(name.begin() + 4, name.end(), ::isdigit)) continue;
+		std::ifstream file(entry.path() / "cpulist");
+		std::string list;
+		if (!(file >> list)) continue;
+		std::vector<int> cpus = parse_cpu_list(list);
+		if (!cpus.empty()) nodes.push_back(cpus);
+	}
+#endif
+	if (nodes.size() < 2) nodes.clear();
+	return nodes;
+}
+
+std::function<void(uint16_t)> get_numa_thread_init() {
+	std::vector<std::vector<int>> nodes = get_numa_nodes();
+	if (nodes.empty()) return nullptr;
+#ifdef __linux__
+	return [nodes](uint16_t id) {
+		const std::vector<int>& cpus = nodes[id % nodes.size()];
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus) CPU_SET(cpu, &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	};
+#else
+	return nullptr;
+#endif
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+// Sizing of the thread pools from the machine the converter runs on
+
+// Cores the process may run on: the CPUs of its affinity mask, limited by a cgroup CPU quota
+uint32_t get_available_cores();
+
+// Number of concurrent writers that keeps the storage of a directory busy. Measured once per
+// directory with a few small synced writes at rising concurrency, later calls reuse the result.
+uint16_t probe_io_threads(const std::string& directory);
+
+// CPUs of every NUMA node, empty if the system has a single node or does not report them
+std::vector<std::vector<int>> get_numa_nodes();
+
+// Thread start hook that pins thread i of a pool to NUMA node i % n, so the buffers a thread
+// fills are allocated on its own node. Returns nullptr on systems with a single node.
+std::function<void(uint16_t)> get_numa_thread_init();
@@ -0,0 +1,432 @@
+#include "TileServer.h"
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include "Logger.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+
+// A node is moved into the cache on its second request, nodes that are only fetched once never displace hot ones
+#define HOT_NODE_REQUESTS 2
+#define MAX_HEADER_SIZE 16384
+// Idle keep-alive connections are closed after this many seconds
+#define CONNECTION_TIMEOUT 30
+
+static const char* endpoint_names[TileServer::NUM_ENDPOINTS] = { "node", "batch", "file", "metrics" };
+
+struct TileServer::Request {
+	std::string method;
+	std::string path;
+	std::string query;
+	bool keep_alive = true;
+	bool has_range = false;
+	uint64_t range_start = 0;
+	uint64_t range_end = UINT64_MAX; // Inclusive, UINT64_MAX for the end of the payload
+};
+
+#ifdef _WIN32
+
+TileServer::TileServer(const std::string& octree_path, uint16_t port, uint64_t cache_bytes, uint16_t num_threads)
+	: reader(octree_path, cache_bytes, num_threads) {
+	throw std::runtime_error("Serve mode is only supported on POSIX systems");
+}
+
+void TileServer::run() {}
+
+#else
+
+static bool send_all(int client, const void* data, uint64_t size) {
+	const char* p = (const char*)data;
+	while (size > 0) {
+		ssize_t sent = send(client, p, size, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			if (sent < 0 && errno == EINTR) continue;
+			return false;
+		}
+		p += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+// Send part of a file without copying it through user space where the system allows it
+static bool send_file_range(int client, const std::string& path, uint64_t offset, uint64_t length) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	bool ok = true;
+#ifdef __linux__
+	off_t off = (off_t)offset;
+	while (length > 0) {
+		ssize_t sent = sendfile(client, fd, &off, length);
+		if (sent <= 0) {
+			if (sent < 0 && errno == EINTR) continue;
+			ok = false;
+			break;
+		}
+		length -= sent;
+	}
+#else
+	char buffer[65536];
+	while (length > 0) {
+		ssize_t n = pread(fd, buffer, std::min<uint64_t>(length, sizeof(buffer)), (off_t)offset);
+		if (n <= 0 || !send_all(client, buffer, n)) {
+			ok = false;
+			break;
+		}
+		offset += n;
+		length -= n;
+	}
+#endif
+	close(fd);
+	return ok;
+}
+
+static bool send_header(int client, int status, uint64_t content_length, bool keep_alive,
+	const std::string& content_type = "application/octet-stream", const std::string& extra = "") {
+	const char* reason = "OK";
+	switch (status) {
+	case 206: reason = "Partial Content"; break;
+	case 400: reason = "Bad Request"; break;
+	case 404: reason = "Not Found"; break;
+	case 405: reason = "Method Not Allowed"; break;
+	case 416: reason = "Range Not Satisfiable"; break;
+	case 431: reason = "Request Header Fields Too Large"; break;
+	case 500: reason = "Internal Server Error"; break;
+	}
+	std::string header = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n"
+		+ "Content-Type: " + content_type + "\r\n"
+		+ "Content-Length: " + std::to_string(content_length) + "\r\n"
+		+ "Accept-Ranges: bytes\r\n"
+		+ "Access-Control-Allow-Origin: *\r\n"
+		+ (keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n")
+		+ extra + "\r\n";
+	return send_all(client, header.data(), header.size());
+}
+
+static int send_error(int client, int status, bool keep_alive) {
+	std::string body = std::to_string(status) + "\n";
+	send_header(client, status, body.size(), keep_alive, "text/plain");
+	send_all(client, body.data(), body.size());
+	return status;
+}
+
+// Resolve the range of a request against a payload of the given size, returns the status to answer with
+static int resolve_range(const TileServer::Request& request, uint64_t size, uint64_t& offset, uint64_t& length, std::string& extra) {
+	offset = 0;
+	length = size;
+	if (!request.has_range) return 200;
+	if (request.range_start >= size) {
+		extra = "Content-Range: bytes */" + std::to_string(size) + "\r\n";
+		return 416;
+	}
+	uint64_t end = std::min(request.range_end, size - 1);
+	offset = request.range_start;
+	length = end - offset + 1;
+	extra = "Content-Range: bytes " + std::to_string(offset) + "-" + std::to_string(end) + "/" + std::to_string(size) + "\r\n";
+	return 206;
+}
+
+static std::string to_lower(std::string s) {
+	for (char& c : s) c = (char)tolower(c);
+	return s;
+}
+
+// Parse "bytes=a-b", "bytes=a-" or "bytes=-n" (the last n bytes are not supported and ignored)
+static void parse_range(const std::string& value, TileServer::Request& request) {
+	unsigned long long start, end;
+	if (sscanf(value.c_str(), "bytes=%llu-%llu", &start, &end) == 2 && end >= start) {
+		request.has_range = true;
+		request.range_start = start;
+		request.range_end = end;
+	}
+	else if (sscanf(value.c_str(), "bytes=%llu-", &start) == 1) {
+		request.has_range = true;
+		request.range_start = start;
+	}
+}
+
+// Node names are the node ids with an "r" in front, so that the root has a name
+static bool parse_node_name(const std::string& name, std::string& id) {
+	if (name.empty() || name[0] != 'r') return false;
+	id = name.substr(1);
+	for (char c : id) {
+		if (c < '0' || c > '7') return false;
+	}
+	return true;
+}
+
+TileServer::TileServer(const std::string& octree_path, uint16_t port, uint64_t cache_bytes, uint16_t num_threads)
+	: reader(octree_path, cache_bytes, num_threads) {
+	this->octree_path = octree_path;
+	this->port = port;
+	this->num_threads = num_threads;
+
+	const std::vector<OctreeNode>& nodes = reader.get_nodes();
+	node_requests.reset(new std::atomic<uint32_t>[nodes.size()]);
+	for (uint32_t i = 0; i < nodes.size(); i++) {
+		node_indices[nodes[i].id] = i;
+		node_requests[i] = 0;
+	}
+}
+
+void TileServer::record(Endpoint endpoint, uint64_t us, bool error) {
+	EndpointStats& s = stats[endpoint];
+	s.requests++;
+	if (error) s.errors++;
+	s.total_us += us;
+	uint64_t max = s.max_us.load();
+	while (us > max && !s.max_us.compare_exchange_weak(max, us)) {}
+	int bucket = 0;
+	while (bucket < 31 && (1ull << bucket) <= us) bucket++;
+	s.buckets[bucket]++;
+}
+
+int TileServer::send_node(int client, const Request& request, const std::string& name) {
+	std::string id;
+	if (!parse_node_name(name, id)) return send_error(client, 400, request.keep_alive);
+	auto it = node_indices.find(id);
+	if (it == node_indices.end()) return send_error(client, 404, request.keep_alive);
+
+	uint32_t index = it->second;
+	uint64_t size = reader.get_nodes()[index].num_points * sizeof(struct Point);
+	uint64_t offset, length;
+	std::string extra;
+	int status = resolve_range(request, size, offset, length, extra);
+	if (status == 416) {
+		send_header(client, status, 0, request.keep_alive, "application/octet-stream", extra);
+		return status;
+	}
+
+	NodeCache::Points points = reader.get_cache().find(index);
+	if (!points && ++node_requests[index] >= HOT_NODE_REQUESTS) points = reader.load_node(index);
+
+	if (!send_header(client, status, length, request.keep_alive, "application/octet-stream", extra)) return status;
+	if (request.method == "HEAD") return status;
+	if (points) {
+		send_all(client, (const char*)points->data() + offset, length);
+		bytes_from_cache += length;
+	}
+	else {
+		send_file_range(client, get_full_point_file(id, octree_path), offset, length);
+		bytes_from_files += length;
+	}
+	return status;
+}
+
+int TileServer::send_file(int client, const Request& request, const std::string& name) {
+	// Only plain files of the octree directory are served
+	if (name.empty() || name.find('/') != std::string::npos || name.find("..") != std::string::npos)
+		return send_error(client, 404, request.keep_alive);
+	std::string path = octree_path + "/" + name;
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return send_error(client, 404, request.keep_alive);
+
+	uint64_t offset, length;
+	std::string extra;
+	int status = resolve_range(request, st.st_size, offset, length, extra);
+	if (!send_header(client, status, status == 416 ? 0 : length, request.keep_alive, "application/octet-stream", extra)) return status;
+	if (status == 416 || request.method == "HEAD") return status;
+	send_file_range(client, path, offset, length);
+	bytes_from_files += length;
+	return status;
+}
+
+int TileServer::send_metrics(int client, const Request& request) {
+	std::ostringstream body;
+	body << "endpoint requests errors avg_us p50_us p90_us p99_us max_us\n";
+	for (int e = 0; e < NUM_ENDPOINTS; e++) {
+		EndpointStats& s = stats[e];
+		uint64_t n = s.requests.load();
+		// Percentiles are reported as the upper bound of their bucket
+		auto percentile = [&](double q) -> uint64_t {
+			uint64_t target = (uint64_t)(n * q), seen = 0;
+			for (int b = 0; b < 32; b++) {
+				seen += s.buckets[b].load();
+				if (seen > target) return 1ull << b;
+			}
+			return 0;
+		};
+		body << endpoint_names[e] << " " << n << " " << s.errors.load() << " " << (n ? s.total_us.load() / n : 0) << " "
+			<< (n ? percentile(0.5) : 0) << " " << (n ? percentile(0.9) : 0) << " " << (n ? percentile(0.99) : 0) << " "
+			<< s.max_us.load() << "\n";
+	}
+	body << "cache_hits " << reader.get_cache().get_hits() << "\n";
+	body << "cache_misses " << reader.get_cache().get_misses() << "\n";
+	body << "bytes_from_cache " << bytes_from_cache.load() << "\n";
+	body << "bytes_from_files " << bytes_from_files.load() << "\n";
+
+	std::string text = body.str();
+	send_header(client, 200, text.size(), request.keep_alive, "text/plain");
+	if (request.method != "HEAD") send_all(client, text.data(), text.size());
+	return 200;
+}
+
+int TileServer::handle_request(int client, Request& request, Endpoint& endpoint) {
+	endpoint = ENDPOINT_FILE;
+	if (request.method != "GET" && request.method != "HEAD") return send_error(client, 405, request.keep_alive);
+
+	if (request.path.rfind("/node/", 0) == 0) {
+		endpoint = ENDPOINT_NODE;
+		return send_node(client, request, request.path.substr(6));
+	}
+	if (request.path == "/metrics") {
+		endpoint = ENDPOINT_METRICS;
+		return send_metrics(client, request);
+	}
+	if (request.path == "/nodes") {
+		endpoint = ENDPOINT_BATCH;
+		if (request.query.rfind("ids=", 0) != 0) return send_error(client, 400, request.keep_alive);
+
+		// Resolve all nodes first, the total size is known from the hierarchy
+		std::vector<std::pair<std::string, uint32_t>> batch;
+		std::stringstream names(request.query.substr(4));
+		std::string name;
+		uint64_t total = 0;
+		while (std::getline(names, name, ',')) {
+			std::string id;
+			if (!parse_node_name(name, id)) return send_error(client, 400, request.keep_alive);
+			auto it = node_indices.find(id);
+			if (it == node_indices.end()) return send_error(client, 404, request.keep_alive);
+			batch.push_back({ id, it->second });
+			total += sizeof(uint64_t) + reader.get_nodes()[it->second].num_points * sizeof(struct Point);
+		}
+
+		if (!send_header(client, 200, total, request.keep_alive)) return 200;
+		if (request.method == "HEAD") return 200;
+		for (auto& [id, index] : batch) {
+			uint64_t size = reader.get_nodes()[index].num_points * sizeof(struct Point);
+			if (!send_all(client, &size, sizeof(size))) break;
+			NodeCache::Points points = reader.get_cache().find(index);
+			if (!points && ++node_requests[index] >= HOT_NODE_REQUESTS) points = reader.load_node(index);
+			bool ok;
+			if (points) {
+				ok = send_all(client, points->data(), size);
+				bytes_from_cache += size;
+			}
+			else {
+				ok = send_file_range(client, get_full_point_file(id, octree_path), 0, size);
+				bytes_from_files += size;
+			}
+			if (!ok) break;
+		}
+		return 200;
+	}
+	return send_file(client, request, request.path.substr(1));
+}
+
+void TileServer::handle_connection(int client) {
+	timeval timeout = { CONNECTION_TIMEOUT, 0 };
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	int one = 1;
+	setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	std::string buffer;
+	char chunk[4096];
+	while (true) {
+		size_t header_end;
+		while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+			if (buffer.size() > MAX_HEADER_SIZE) {
+				send_error(client, 431, false);
+				return;
+			}
+			ssize_t n = recv(client, chunk, sizeof(chunk), 0);
+			if (n <= 0) return;
+			buffer.append(chunk, n);
+		}
+		auto start = std::chrono::steady_clock::now();
+
+		Request request;
+		std::istringstream lines(buffer.substr(0, header_end));
+		buffer.erase(0, header_end + 4);
+
+		std::string line, target, version;
+		std::getline(lines, line);
+		std::istringstream request_line(line);
+		request_line >> request.method >> target >> version;
+		if (version == "HTTP/1.0") request.keep_alive = false;
+		size_t q = target.find('?');
+		request.path = target.substr(0, q);
+		if (q != std::string::npos) request.query = target.substr(q + 1);
+
+		while (std::getline(lines, line)) {
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			size_t colon = line.find(':');
+			if (colon == std::string::npos) continue;
+			std::string key = to_lower(line.substr(0, colon));
+			std::string value = line.substr(colon + 1);
+			value.erase(0, value.find_first_not_of(' '));
+			if (key == "range") parse_range(value, request);
+			else if (key == "connection") {
+				std::string v = to_lower(value);
+				if (v == "close") request.keep_alive = false;
+				else if (v == "keep-alive") request.keep_alive = true;
+			}
+		}
+
+		Endpoint endpoint = ENDPOINT_FILE;
+		int status;
+		try {
+			status = handle_request(client, request, endpoint);
+		}
+		catch (const std::exception& e) {
+			Logger::log_warning("Error serving '" + target + "': " + e.what());
+			status = send_error(client, 500, false);
+			request.keep_alive = false;
+		}
+		uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		record(endpoint, us, status >= 400);
+
+		if (!request.keep_alive) return;
+	}
+}
+
+void TileServer::run() {
+	signal(SIGPIPE, SIG_IGN);
+
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	if (server < 0) throw std::runtime_error("Could not create socket");
+	int one = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (bind(server, (sockaddr*)&address, sizeof(address)) != 0 || listen(server, 128) != 0) {
+		close(server);
+		throw std::runtime_error("Could not listen on port " + std::to_string(port) + " (" + strerror(errno) + ")");
+	}
+	Logger::log_info("Serving " + octree_path + " (" + std::to_string(reader.get_nodes().size()) + " nodes) on http://127.0.0.1:" + std::to_string(port));
+
+	// Every connection is handled by one pool thread until it is closed
+	ThreadPool pool(num_threads);
+	while (true) {
+		int client = accept(server, nullptr, nullptr);
+		if (client < 0) {
+			if (errno == EINTR) continue;
+			Logger::log_warning("Could not accept connection (" + std::string(strerror(errno)) + ")");
+			continue;
+		}
+		pool.add_job([this, client] {
+			handle_connection(client);
+			close(client);
+		});
+	}
+}
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include "OctreeReader.h"
+
+// Serves a converted octree over HTTP on localhost. The hierarchy is loaded once; node
+// payloads that are requested repeatedly are kept in an LRU cache, all others are sent
+// straight from their files with sendfile.
+//
+//   GET /node/<name>           Payload of a node, the root is "r" and its children r0 to r7.
+//                              Supports single byte ranges (Range: bytes=a-b).
+//   GET /nodes?ids=r,r0,r04    Several payloads in one response, each one prefixed by its
+//                              size in bytes as a little endian u64.
+//   GET /metrics               Request counts and latencies per endpoint, cache statistics.
+//   GET /<file>                Any other file of the octree directory (hierarchy.bin, octree.bin,
+//                              attribute columns), with byte ranges.
+class TileServer {
+public:
+	enum Endpoint {
+		ENDPOINT_NODE,
+		ENDPOINT_BATCH,
+		ENDPOINT_FILE,
+		ENDPOINT_METRICS,
+		NUM_ENDPOINTS
+	};
+
+	struct Request;
+
+private:
+	// Latencies in microseconds, bucket i counts requests that took less than 2^i us
+	struct EndpointStats {
+		std::atomic<uint64_t> requests{ 0 };
+		std::atomic<uint64_t> errors{ 0 };
+		std::atomic<uint64_t> total_us{ 0 };
+		std::atomic<uint64_t> max_us{ 0 };
+		std::atomic<uint64_t> buckets[32] = {};
+	};
+
+	std::string octree_path;
+	uint16_t port;
+	uint16_t num_threads;
+	OctreeReader reader;
+	std::unordered_map<std::string, uint32_t> node_indices;
+	std::unique_ptr<std::atomic<uint32_t>[]> node_requests;
+	EndpointStats stats[NUM_ENDPOINTS];
+	std::atomic<uint64_t> bytes_from_cache{ 0 };
+	std::atomic<uint64_t> bytes_from_files{ 0 };
+
+	void handle_connection(int client);
+	int handle_request(int client, Request& request, Endpoint& endpoint);
+
+	int send_node(int client, const Request& request, const std::string& name);
+	int send_file(int client, const Request& request, const std::string& path);
+	int send_metrics(int client, const Request& request);
+
+	void record(Endpoint endpoint, uint64_t us, bool error);
+
+public:
+	TileServer(const std::string& octree_path, uint16_t port, uint64_t cache_bytes, uint16_t num_threads);
+
+	// Accept connections until the process is stopped
+	void run();
+};
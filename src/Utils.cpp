@@ -64,6 +64,51 @@ std::string get_full_temp_point_file(const std::string& hierarchy, const std::st
 	return output_path + "/temp" + hierarchy + ".bin";
 }
 
+std::string get_stream_point_file(uint32_t index, const std::string& output_path) {
+	return output_path + "/stream" + std::to_string(index) + ".bin";
+}
+
 std::string get_octree_file(const std::string& output_path) {
 	return output_path + "/octree.bin";
-}
\ No newline at end of file
+}
+
+/// <summary>
+/// Get the path of the input manifest that belongs to an input file or directory.
+/// </summary>
+/// <param name="input_path">The input file or directory.</param>
+/// <param name="is_dir">Whether the input is a directory.</param>
+/// <returns>The path to the manifest file.</returns>
+std::string get_manifest_file(const std::string& input_path, bool is_dir) {
+	if (is_dir) return input_path + "/.pcc_manifest.bin";
+	return input_path + ".pcc_manifest.bin";
+}
+
+/// <summary>
+/// Determine the format of an input point file from its extension.
+/// </summary>
+/// <param name="path">The path to the point file.</param>
+/// <returns>One of the POINT_FILE_FORMAT_* values, or -1 if the format is not supported.</returns>
+int get_point_file_format(const std::string& path) {
+	std::string ext = std::filesystem::path(path).extension().string();
+	for (char& c : ext) c = (char)tolower(c);
+
+	if (ext == ".las") return POINT_FILE_FORMAT_LAS;
+	if (ext == ".laz") return POINT_FILE_FORMAT_LAZ;
+	if (ext == ".pts" || ext == ".xyz" || ext == ".csv" || ext == ".txt") return POINT_FILE_FORMAT_PTS;
+	if (ext == ".bin") return POINT_FILE_FORMAT_RAW;
+	return -1;
+}
+
+std::string get_jobs_directory(const std::string& output_path) {
+	return output_path + "/jobs";
+}
+
+/// <summary>
+/// Get the path of the file that holds one attribute column of a point file.
+/// </summary>
+/// <param name="point_file">The point file of the node, ending in ".bin".</param>
+/// <param name="attribute">The name of the attribute.</param>
+/// <returns>The path to the attribute file, p&lt;id&gt;.&lt;attribute&gt;.bin for p&lt;id&gt;.bin.</returns>
+std::string get_attribute_file(const std::string& point_file, const std::string& attribute) {
+	return point_file.substr(0, point_file.size() - 4) + "." + attribute + ".bin";
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <filesystem>
 #include <string>
+#include "Data.h"
 
 #define THROW_FILE_OPEN_ERROR throw std::runtime_error("Could not open file (" + std::string(strerror(errno)) + ")")
 
@@ -14,4 +15,15 @@ std::string get_full_point_file(const std::string& hierarchy, const std::string&
 
 std::string get_full_temp_point_file(const std::string& hierarchy, const std::string& output_path);
 
-std::string get_octree_file(const std::string& output_path);
\ No newline at end of file
+// Spill file of a bucket while streaming, before the node ids are known
+std::string get_stream_point_file(uint32_t index, const std::string& output_path);
+
+std::string get_octree_file(const std::string& output_path);
+
+std::string get_manifest_file(const std::string& input_path, bool is_dir);
+
+int get_point_file_format(const std::string& path);
+
+std::string get_jobs_directory(const std::string& output_path);
+
+std::string get_attribute_file(const std::string& point_file, const std::string& attribute);
@@ -0,0 +1,535 @@
+#include <string>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "Logger.h"
+#include "Converter.h"
+#include "LasPointReader.h"
+#include "ThreadTuning.h"
+#include "Utils.h"
+
+// Scaling harness of the converter:
+// pcc-bench <work directory> [--sizes n,...] [--memory-mb mb,...] [--threads n,...] [--input file]...
+//     [--repeat n] [--tolerance t] [--adaptive-split] [--keep] [--report report.csv]
+//
+// Converts every dataset with every in-core memory budget and thread count. Each conversion
+// runs in its own child process, so its peak RSS and I/O counters are its own. Synthetic
+// datasets (terrain, buildings and vegetation at constant density) are generated into
+// <work directory>/data once and reused. The budget is enforced by the builder: it limits the
+// points of the nodes that are split in-core, everything above it is split out-of-core.
+// Caches are not dropped between runs, so input reads may come from the page cache.
+//
+// The report lists every run and then how the wall time scales: the exponent k of
+// time ~ points^k between consecutive sizes, the speedup over the fewest threads and the
+// slowdown over the largest budget. Steps with k > 1 + tolerance are marked as superlinear
+// and make the harness exit with SUPERLINEAR.
+
+enum class ErrCode {
+	INVALID_ARGS = 1,
+	BENCH_FAIL = 2,
+	SUPERLINEAR = 3,
+};
+
+// A node that is split in-core holds its points and the copies for its children, and one
+// child index per point
+#define IN_CORE_BYTES_PER_POINT (2 * sizeof(Point) + 1)
+// Density of the synthetic datasets in points per square meter
+#define SYNTHETIC_DENSITY 20.0
+#define SYNTHETIC_BATCH_SIZE (1 << 16)
+
+void fail(ErrCode code) {
+	Logger::log_error("Benchmark failed (error code " + std::to_string((int)code) + ")");
+	exit((int)code);
+}
+
+// Parse a comma separated list of numbers
+std::vector<double> parse_list(const std::string& s) {
+	std::vector<double> values;
+	std::stringstream stream(s);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		try {
+			values.push_back(std::stod(item));
+		}
+		catch (const std::exception&) {
+			Logger::log_error("Invalid number '" + item + "'");
+			fail(ErrCode::INVALID_ARGS);
+		}
+	}
+	return values;
+}
+
+std::vector<double> parse_list(const std::string& option, const std::string& s, size_t count) {
+	std::vector<double> values = parse_list(s);
+	if (values.size() != count) {
+		Logger::log_error(option + " expects " + std::to_string(count) + " values");
+		fail(ErrCode::INVALID_ARGS);
+	}
+	return values;
+}
+
+struct Dataset {
+	std::string name;
+	std::string path;
+	uint64_t num_points;
+};
+
+struct BenchRun {
+	const Dataset* dataset;
+	uint64_t memory_mb; // 0 is the default budget of the builder
+	uint16_t threads;
+
+	bool ok = false;
+	std::string error;
+	double seconds = 0.0;
+	double cpu_seconds = 0.0;
+	uint64_t peak_rss_kb = 0;
+	// Bytes passed to read and write calls, and bytes that reached the storage
+	uint64_t bytes_read = 0, bytes_written = 0;
+	uint64_t storage_bytes_read = 0, storage_bytes_written = 0;
+	uint64_t num_files = 0;
+	uint64_t output_bytes = 0;
+};
+
+// Sent from the child process that converted to the harness
+struct ChildReport {
+	uint64_t rchar, wchar, read_bytes, write_bytes;
+	char error[256];
+};
+
+// Write a LAS 1.2 file (point format 2) with a scene of num_points points. The area grows
+// with the number of points, so all datasets have the same density.
+void generate_dataset(const std::string& path, uint64_t num_points) {
+	const double scale = 0.001;
+	const double side = std::sqrt(num_points / SYNTHETIC_DENSITY);
+	std::mt19937_64 rng(num_points);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+	std::string temp_path = path + ".tmp";
+	FILE* file = fopen(temp_path.c_str(), "wb");
+	if (!file) throw std::runtime_error("Could not open '" + temp_path + "'");
+
+	uint8_t header[227] = {};
+	memcpy(header, "LASF", 4);
+	header[24] = 1; header[25] = 2;
+	uint16_t header_size = sizeof(header), record_length = 26;
+	uint32_t point_offset = sizeof(header), legacy_num_points = (uint32_t)std::min<uint64_t>(num_points, UINT32_MAX);
+	memcpy(header + 94, &header_size, 2);
+	memcpy(header + 96, &point_offset, 4);
+	header[104] = 2;
+	memcpy(header + 105, &record_length, 2);
+	memcpy(header + 107, &legacy_num_points, 4);
+	double scales[3] = { scale, scale, scale }, offsets[3] = { 0.0, 0.0, 0.0 };
+	memcpy(header + 131, scales, sizeof(scales));
+	memcpy(header + 155, offsets, sizeof(offsets));
+	fwrite(header, 1, sizeof(header), file);
+
+	auto terrain = [&](double x, double y) { return 8.0 * std::sin(x / 57.0) * std::cos(y / 43.0) + 0.01 * x; };
+	Bounds bounds;
+	std::vector<uint8_t> records;
+	records.reserve((size_t)SYNTHETIC_BATCH_SIZE * record_length);
+	for (uint64_t i = 0; i < num_points; i++) {
+		double x = uniform(rng) * side, y = uniform(rng) * side, z;
+		uint8_t classification, returns = 1 | (1 << 3);
+		double kind = uniform(rng);
+		// Buildings and trees stand on a 40 m grid of blocks
+		double block_x = std::floor(x / 40.0), block_y = std::floor(y / 40.0);
+		uint64_t block = (uint64_t)(block_x * 7919.0 + block_y * 104729.0);
+		if (kind < 0.15) {
+			// Flat roof of a building in the middle of the block
+			x = (block_x + 0.25 + uniform(rng) * 0.5) * 40.0;
+			y = (block_y + 0.25 + uniform(rng) * 0.5) * 40.0;
+			z = terrain(block_x * 40.0, block_y * 40.0) + 5.0 + (block % 5) * 3.0;
+			classification = 6;
+		}
+		else if (kind < 0.3) {
+			// Tree crown, a sphere of points with several returns
+			double cx = (block_x + 0.1) * 40.0, cy = (block_y + 0.1) * 40.0, r = 3.0 + (block % 3);
+			double u = uniform(rng) * 2.0 - 1.0, phi = uniform(rng) * 6.2831853, d = r * std::cbrt(uniform(rng));
+			x = cx + d * std::sqrt(1.0 - u * u) * std::cos(phi);
+			y = cy + d * std::sqrt(1.0 - u * u) * std::sin(phi);
+			z = terrain(cx, cy) + r + 2.0 + d * u;
+			classification = 5;
+			returns = (uint8_t)(1 + (i % 3)) | (3 << 3);
+		}
+		else {
+			z = terrain(x, y) + uniform(rng) * 0.05;
+			classification = 2;
+		}
+		int32_t xi = (int32_t)std::llround(x / scale), yi = (int32_t)std::llround(y / scale), zi = (int32_t)std::llround(z / scale);
+		uint16_t color[3] = { (uint16_t)(classification * 9000), (uint16_t)(65535 - classification * 9000), (uint16_t)(zi & 0xFFFF) };
+		Point p = { (float)(xi * scale), (float)(yi * scale), (float)(zi * scale), color[0], color[1], color[2] };
+		bounds.add(p);
+
+		uint8_t record[26] = {};
+		uint16_t intensity = (uint16_t)(uniform(rng) * 4096.0);
+		memcpy(record, &xi, 4); memcpy(record + 4, &yi, 4); memcpy(record + 8, &zi, 4);
+		memcpy(record + 12, &intensity, 2);
+		record[14] = returns;
+		record[15] = classification;
+		memcpy(record + 20, color, sizeof(color));
+		records.insert(records.end(), record, record + sizeof(record));
+		if (records.size() >= (size_t)SYNTHETIC_BATCH_SIZE * record_length) {
+			fwrite(records.data(), 1, records.size(), file);
+			records.clear();
+		}
+	}
+	fwrite(records.data(), 1, records.size(), file);
+
+	double extents[6] = { bounds.max_x, bounds.min_x, bounds.max_y, bounds.min_y, bounds.max_z, bounds.min_z };
+	fseek(file, 179, SEEK_SET);
+	fwrite(extents, sizeof(double), 6, file);
+	bool failed = ferror(file) != 0;
+	fclose(file);
+	if (failed) throw std::runtime_error("Could not write '" + temp_path + "'");
+	std::filesystem::rename(temp_path, path);
+}
+
+// Read the I/O counters of this process from /proc
+static void read_io_counters(ChildReport& report) {
+	std::ifstream file("/proc/self/io");
+	std::string key;
+	uint64_t value;
+	while (file >> key >> value) {
+		if (key == "rchar:") report.rchar = value;
+		else if (key == "wchar:") report.wchar = value;
+		else if (key == "read_bytes:") report.read_bytes = value;
+		else if (key == "write_bytes:") report.write_bytes = value;
+	}
+}
+
+// Convert the dataset of a run in a child process and collect what it used
+void execute_run(BenchRun& run, const std::string& output_path, const std::string& log_path,
+	uint16_t io_threads, bool adaptive_split) {
+	int fds[2];
+	if (pipe(fds) != 0) throw std::runtime_error("Could not create a pipe");
+
+	// Buffered output would be written again by the child
+	std::cout.flush();
+	auto start = std::chrono::steady_clock::now();
+	pid_t pid = fork();
+	if (pid < 0) throw std::runtime_error("Could not start a child process");
+	if (pid == 0) {
+		close(fds[0]);
+		int log = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (log >= 0) {
+			dup2(log, STDOUT_FILENO);
+			dup2(log, STDERR_FILENO);
+			close(log);
+		}
+
+		ChildReport report = {};
+		int status = 0;
+		try {
+			ConverterOptions options;
+			options.build.compute_threads = run.threads;
+			options.build.io_threads = io_threads;
+			options.build.adaptive_split = adaptive_split;
+			if (run.memory_mb) options.build.max_points_in_core = std::max<uint64_t>((run.memory_mb << 20) / IN_CORE_BYTES_PER_POINT, 1);
+			Converter converter(output_path, options);
+			converter.add_file(run.dataset->path);
+			converter.convert();
+		}
+		catch (const std::exception& e) {
+			strncpy(report.error, e.what(), sizeof(report.error) - 1);
+			status = 1;
+		}
+		read_io_counters(report);
+		std::cout.flush();
+		if (write(fds[1], &report, sizeof(report)) != sizeof(report)) status = 1;
+		_exit(status);
+	}
+
+	close(fds[1]);
+	ChildReport report = {};
+	ssize_t received = read(fds[0], &report, sizeof(report));
+	close(fds[0]);
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) != pid) throw std::runtime_error("Lost the child process");
+	run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	run.peak_rss_kb = usage.ru_maxrss;
+	run.cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	run.bytes_read = report.rchar;
+	run.bytes_written = report.wchar;
+	run.storage_bytes_read = report.read_bytes;
+	run.storage_bytes_written = report.write_bytes;
+	run.ok = received == sizeof(report) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	if (!run.ok) {
+		if (received == sizeof(report) && report.error[0]) run.error = report.error;
+		else run.error = WIFSIGNALED(status) ? "killed by signal " + std::to_string(WTERMSIG(status)) : "exited with " + std::to_string(WEXITSTATUS(status));
+		return;
+	}
+
+	std::error_code ec;
+	for (auto& entry : std::filesystem::recursive_directory_iterator(output_path, ec)) {
+		if (!entry.is_regular_file()) continue;
+		run.num_files++;
+		run.output_bytes += entry.file_size();
+	}
+}
+
+static std::string format(const char* fmt, double value) {
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), fmt, value);
+	return buffer;
+}
+
+static std::string get_budget_name(uint64_t memory_mb) {
+	return memory_mb ? std::to_string(memory_mb) + "MB" : "default";
+}
+
+// Print the runs and the scaling between them, returns the number of superlinear steps
+uint32_t write_report(const std::vector<BenchRun>& runs, const std::vector<Dataset>& datasets,
+	const std::vector<uint64_t>& memory_budgets, const std::vector<uint16_t>& thread_counts, double tolerance) {
+	auto find = [&](const Dataset* d, uint64_t memory_mb, uint16_t threads) -> const BenchRun* {
+		for (const BenchRun& r : runs) {
+			if (r.dataset == d && r.memory_mb == memory_mb && r.threads == threads && r.ok) return &r;
+		}
+		return nullptr;
+	};
+	const double mb = 1024.0 * 1024.0;
+
+	Logger::log_raw("\ndataset              points   budget  threads   time[s]  cpu[s]  Mpts/s  rss[MB]  read[MB]  written[MB]  files  output[MB]\n");
+	for (const BenchRun& r : runs) {
+		char line[512];
+		if (!r.ok) {
+			snprintf(line, sizeof(line), "%-16s %10llu %8s %8u   failed: %s\n", r.dataset->name.c_str(), (unsigned long long)r.dataset->num_points,
+				get_budget_name(r.memory_mb).c_str(), (unsigned)r.threads, r.error.c_str());
+		}
+		else {
+			snprintf(line, sizeof(line), "%-16s %10llu %8s %8u %9.2f %7.2f %7.2f %8.0f %9.0f %12.0f %6llu %11.0f\n", r.dataset->name.c_str(),
+				(unsigned long long)r.dataset->num_points, get_budget_name(r.memory_mb).c_str(), (unsigned)r.threads, r.seconds, r.cpu_seconds,
+				r.dataset->num_points / r.seconds / 1e6, r.peak_rss_kb / 1024.0, r.bytes_read / mb, r.bytes_written / mb,
+				(unsigned long long)r.num_files, r.output_bytes / mb);
+		}
+		Logger::log_raw(line);
+	}
+
+	// Datasets by size, the exponent is only meaningful between different sizes
+	std::vector<const Dataset*> by_size;
+	for (const Dataset& d : datasets) by_size.push_back(&d);
+	std::sort(by_size.begin(), by_size.end(), [](const Dataset* a, const Dataset* b) { return a->num_points < b->num_points; });
+
+	uint32_t superlinear = 0;
+	if (by_size.size() > 1) Logger::log_raw("\nScaling with the number of points (time ~ points^k):\n");
+	for (uint64_t memory_mb : memory_budgets) {
+		for (uint16_t threads : thread_counts) {
+			const BenchRun* previous = nullptr;
+			for (const Dataset* d : by_size) {
+				const BenchRun* r = find(d, memory_mb, threads);
+				if (!r) continue;
+				if (previous && r->dataset->num_points > previous->dataset->num_points) {
+					double k = std::log(r->seconds / previous->seconds)
+						/ std::log((double)r->dataset->num_points / previous->dataset->num_points);
+					bool is_superlinear = k > 1.0 + tolerance;
+					if (is_superlinear) superlinear++;
+					Logger::log_raw("  budget " + get_budget_name(memory_mb) + ", " + std::to_string(threads) + " threads: "
+						+ std::to_string(previous->dataset->num_points) + " -> " + std::to_string(r->dataset->num_points)
+						+ " points, k = " + format("%.2f", k) + (is_superlinear ? "  SUPERLINEAR" : "") + "\n");
+				}
+				previous = r;
+			}
+		}
+	}
+
+	if (thread_counts.size() > 1) {
+		Logger::log_raw("\nSpeedup over " + std::to_string(thread_counts.front()) + " threads:\n");
+		for (const Dataset* d : by_size) {
+			for (uint64_t memory_mb : memory_budgets) {
+				const BenchRun* base = find(d, memory_mb, thread_counts.front());
+				if (!base) continue;
+				std::string line = "  " + d->name + ", budget " + get_budget_name(memory_mb) + ":";
+				for (uint16_t threads : thread_counts) {
+					const BenchRun* r = find(d, memory_mb, threads);
+					if (r) line += "  " + std::to_string(threads) + "t " + format("%.2fx", base->seconds / r->seconds);
+				}
+				Logger::log_raw(line + "\n");
+			}
+		}
+	}
+
+	if (memory_budgets.size() > 1) {
+		Logger::log_raw("\nTime relative to the largest budget (" + get_budget_name(memory_budgets.back()) + "):\n");
+		for (const Dataset* d : by_size) {
+			for (uint16_t threads : thread_counts) {
+				const BenchRun* base = find(d, memory_budgets.back(), threads);
+				if (!base) continue;
+				std::string line = "  " + d->name + ", " + std::to_string(threads) + " threads:";
+				for (uint64_t memory_mb : memory_budgets) {
+					const BenchRun* r = find(d, memory_mb, threads);
+					if (r) line += "  " + get_budget_name(memory_mb) + " " + format("%.2fx", r->seconds / base->seconds);
+				}
+				Logger::log_raw(line + "\n");
+			}
+		}
+	}
+	return superlinear;
+}
+
+void write_csv(const std::vector<BenchRun>& runs, const std::string& path) {
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file) throw std::runtime_error("Could not open '" + path + "'");
+	fprintf(file, "dataset,points,memory_mb,threads,ok,seconds,cpu_seconds,peak_rss_kb,bytes_read,bytes_written,"
+		"storage_bytes_read,storage_bytes_written,files,output_bytes\n");
+	for (const BenchRun& r : runs) {
+		fprintf(file, "%s,%llu,%llu,%u,%d,%.3f,%.3f,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", r.dataset->name.c_str(),
+			(unsigned long long)r.dataset->num_points, (unsigned long long)r.memory_mb, (unsigned)r.threads, r.ok ? 1 : 0,
+			r.seconds, r.cpu_seconds, (unsigned long long)r.peak_rss_kb, (unsigned long long)r.bytes_read,
+			(unsigned long long)r.bytes_written, (unsigned long long)r.storage_bytes_read, (unsigned long long)r.storage_bytes_written,
+			(unsigned long long)r.num_files, (unsigned long long)r.output_bytes);
+	}
+	fclose(file);
+}
+
+int main(int argc, char* argv[]) {
+	Logger::add_thread_alias("MAIN");
+
+	std::vector<std::string> args;
+	std::vector<uint64_t> sizes;
+	std::vector<uint64_t> memory_budgets;
+	std::vector<uint16_t> thread_counts;
+	std::vector<std::string> inputs;
+	uint32_t repeat = 1;
+	double tolerance = 0.15;
+	bool adaptive_split = false;
+	bool keep = false;
+	std::string report_path;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--sizes" && i + 1 < argc) {
+			for (double v : parse_list(argv[++i])) sizes.push_back((uint64_t)v);
+		}
+		else if (arg == "--memory-mb" && i + 1 < argc) {
+			for (double v : parse_list(argv[++i])) memory_budgets.push_back((uint64_t)v);
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			for (double v : parse_list(argv[++i])) thread_counts.push_back((uint16_t)std::max(1.0, v));
+		}
+		else if (arg == "--input" && i + 1 < argc) {
+			inputs.push_back(argv[++i]);
+		}
+		else if (arg == "--repeat" && i + 1 < argc) {
+			repeat = std::max(1u, (uint32_t)parse_list(arg, argv[++i], 1)[0]);
+		}
+		else if (arg == "--tolerance" && i + 1 < argc) {
+			tolerance = parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--adaptive-split") {
+			adaptive_split = true;
+		}
+		else if (arg == "--keep") {
+			keep = true;
+		}
+		else if (arg == "--report" && i + 1 < argc) {
+			report_path = argv[++i];
+		}
+		else if (arg.rfind("--", 0) == 0) {
+			Logger::log_error("Unknown option '" + arg + "'");
+			fail(ErrCode::INVALID_ARGS);
+		}
+		else {
+			args.push_back(arg);
+		}
+	}
+
+	if (args.size() != 1) {
+		Logger::log_error("Invalid arguments");
+		fail(ErrCode::INVALID_ARGS);
+	}
+	const std::string work_path = args[0];
+	if (sizes.empty() && inputs.empty()) sizes = { 1'000'000, 4'000'000, 16'000'000 };
+	if (memory_budgets.empty()) memory_budgets = { 0 };
+	if (thread_counts.empty()) {
+		uint16_t cores = (uint16_t)std::min<uint32_t>(get_available_cores(), UINT16_MAX);
+		for (uint16_t t = 1; t < cores; t *= 2) thread_counts.push_back(t);
+		thread_counts.push_back(cores);
+	}
+	// The default budget (0) is the largest one
+	std::sort(memory_budgets.begin(), memory_budgets.end(), [](uint64_t a, uint64_t b) { return (a ? a : UINT64_MAX) < (b ? b : UINT64_MAX); });
+	std::sort(thread_counts.begin(), thread_counts.end());
+
+	try {
+		std::filesystem::create_directories(work_path + "/data");
+		std::filesystem::create_directories(work_path + "/runs");
+		std::filesystem::create_directories(work_path + "/logs");
+
+		std::vector<Dataset> datasets;
+		for (uint64_t n : sizes) {
+			Dataset d = { "synthetic_" + std::to_string(n), work_path + "/data/synthetic_" + std::to_string(n) + ".las", n };
+			if (!std::filesystem::exists(d.path)) {
+				Logger::log_info("Generating " + std::to_string(n) + " points...");
+				generate_dataset(d.path, n);
+			}
+			datasets.push_back(d);
+		}
+		for (const std::string& input : inputs) {
+			if (get_point_file_format(input) != POINT_FILE_FORMAT_LAS) throw std::runtime_error("Only LAS files can be added as datasets");
+			FILE* file = fopen(input.c_str(), "rb");
+			if (!file) throw std::runtime_error("Could not open '" + input + "'");
+			LasHeader header = LasPointReader::read_header(file);
+			fclose(file);
+			datasets.push_back({ std::filesystem::path(input).stem().string(), input, header.num_points });
+		}
+
+		// The storage is probed once, so every run uses the same writers and no probe is measured
+		uint16_t io_threads = probe_io_threads(work_path + "/runs");
+		Logger::log_info("Running " + std::to_string(datasets.size() * memory_budgets.size() * thread_counts.size() * repeat)
+			+ " conversions with " + std::to_string(io_threads) + " I/O threads");
+
+		std::vector<BenchRun> runs;
+		for (const Dataset& d : datasets) {
+			for (uint64_t memory_mb : memory_budgets) {
+				for (uint16_t threads : thread_counts) {
+					// Repeated runs are reduced to the one with the median time
+					std::vector<BenchRun> repeats;
+					for (uint32_t r = 0; r < repeat; r++) {
+						std::string name = d.name + "_" + get_budget_name(memory_mb) + "_t" + std::to_string(threads) + "_r" + std::to_string(r);
+						std::string output_path = work_path + "/runs/" + name;
+						std::filesystem::remove_all(output_path);
+
+						BenchRun run;
+						run.dataset = &d;
+						run.memory_mb = memory_mb;
+						run.threads = threads;
+						execute_run(run, output_path, work_path + "/logs/" + name + ".log", io_threads, adaptive_split);
+						if (!keep) std::filesystem::remove_all(output_path);
+
+						if (run.ok) Logger::log_info(name + ": " + format("%.2f", run.seconds) + "s, " + std::to_string(run.peak_rss_kb / 1024) + " MB peak RSS");
+						else Logger::log_warning(name + " failed: " + run.error);
+						repeats.push_back(run);
+					}
+					std::sort(repeats.begin(), repeats.end(), [](const BenchRun& a, const BenchRun& b) {
+						if (a.ok != b.ok) return a.ok;
+						return a.seconds < b.seconds;
+					});
+					runs.push_back(repeats[repeats.size() / 2].ok ? repeats[repeats.size() / 2] : repeats.front());
+				}
+			}
+		}
+
+		if (!report_path.empty()) write_csv(runs, report_path);
+		uint32_t superlinear = write_report(runs, datasets, memory_budgets, thread_counts, tolerance);
+		if (std::any_of(runs.begin(), runs.end(), [](const BenchRun& r) { return !r.ok; })) fail(ErrCode::BENCH_FAIL);
+		if (superlinear) {
+			Logger::log_warning(std::to_string(superlinear) + " superlinear steps");
+			fail(ErrCode::SUPERLINEAR);
+		}
+	}
+	catch (const std::exception& e) {
+		Logger::log_error(e.what());
+		fail(ErrCode::BENCH_FAIL);
+	}
+	return 0;
+}
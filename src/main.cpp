@@ -1,19 +1,31 @@
 #include <string>
 #include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 #include "Logger.h"
 #include "Builder.h"
 #include "Utils.h"
 #include "HierarchyWriter.h"
 #include "LasPointReader.h"
+#include "InputManifest.h"
+#include "IngestFilter.h"
+#include "Distributed.h"
+#include "TileServer.h"
+#include "StreamBuilder.h"
 
 //#define SKIP_READ
 #define SKIP_BOUNDS { 372.735f, 36.274f, 568.365f, 134.426f }
+// Every open connection holds a thread of the serve pool and browsers keep several open, so the
+// pool has at least this many threads unless --threads is given
+#define SERVE_MIN_THREADS 8
 
 enum class ErrCode {
 	INVALID_ARGS = 1,
 	OUT_NOT_EMPTY = 2,
 	BUILD_FAIL = 3,
 	SAMPLE_FAIL = 4,
+	SERVE_FAIL = 5,
 };
 
 void fail(ErrCode code) {
@@ -21,6 +33,53 @@ void fail(ErrCode code) {
 	exit((int)code);
 }
 
+// Parse a comma separated list of numbers
+std::vector<double> parse_list(const std::string& s) {
+	std::vector<double> values;
+	std::stringstream stream(s);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		try {
+			values.push_back(std::stod(item));
+		}
+		catch (const std::exception&) {
+			Logger::log_error("Invalid number '" + item + "'");
+			fail(ErrCode::INVALID_ARGS);
+		}
+	}
+	return values;
+}
+
+std::vector<double> parse_list(const std::string& option, const std::string& s, size_t count) {
+	std::vector<double> values = parse_list(s);
+	if (values.size() != count) {
+		Logger::log_error(option + " expects " + std::to_string(count) + " values");
+		fail(ErrCode::INVALID_ARGS);
+	}
+	return values;
+}
+
+// Read a crop polygon, one "x y" or "x,y" vertex per line
+void load_crop_polygon(const std::string& path, IngestFilter& filter) {
+	std::ifstream file(path);
+	if (!file) {
+		Logger::log_error("Could not open polygon file");
+		fail(ErrCode::INVALID_ARGS);
+	}
+	std::vector<double> x, y;
+	std::string line;
+	while (std::getline(file, line)) {
+		std::replace(line.begin(), line.end(), ',', ' ');
+		std::stringstream stream(line);
+		double vx, vy;
+		if (stream >> vx >> vy) {
+			x.push_back(vx);
+			y.push_back(vy);
+		}
+	}
+	filter.set_crop_polygon(x, y);
+}
+
 #if _DEBUG
 void count_points(Node* node, uint64_t& points, uint64_t& nodes) {
 	points += node->num_points;
@@ -36,61 +95,364 @@ void count_points(Node* node, uint64_t& points, uint64_t& nodes) {
 int main(int argc, char* argv[]) {
 	Logger::add_thread_alias("MAIN");
 
-	if (argc != 3) {
+	std::vector<std::string> args;
+	std::string manifest_path;
+	bool use_manifest = true;
+	IngestFilter filter;
+	BuildOptions build_options;
+	uint32_t num_local_workers = 0;
+	bool worker_mode = false;
+	uint16_t serve_port = 8080;
+	uint64_t serve_cache_mb = 1024;
+	std::string stdin_format = "text";
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--manifest" && i + 1 < argc) {
+			manifest_path = argv[++i];
+		}
+		else if (arg == "--no-manifest") {
+			use_manifest = false;
+		}
+		else if (arg == "--non-redundant") {
+			build_options.non_redundant = true;
+		}
+		else if (arg == "--attributes" && i + 1 < argc) {
+			try {
+				build_options.attributes = AttributeSchema::parse(argv[++i]);
+			}
+			catch (const std::exception& e) {
+				Logger::log_error(e.what());
+				fail(ErrCode::INVALID_ARGS);
+			}
+		}
+		else if (arg == "--morton") {
+			build_options.morton_order = true;
+		}
+		else if (arg == "--morton-index" && i + 1 < argc) {
+			int depth = (int)parse_list(arg, argv[++i], 1)[0];
+			if (depth < 1 || depth > MORTON_MAX_INDEX_DEPTH) {
+				Logger::log_error("--morton-index expects a depth from 1 to " + std::to_string(MORTON_MAX_INDEX_DEPTH));
+				fail(ErrCode::INVALID_ARGS);
+			}
+			build_options.morton_order = true;
+			build_options.morton_index_depth = (uint8_t)depth;
+		}
+		else if (arg == "--dedup" && i + 1 < argc) {
+			build_options.duplicate_tolerance = parse_list(arg, argv[++i], 1)[0];
+			if (build_options.duplicate_tolerance <= 0.0) {
+				Logger::log_error("--dedup expects a tolerance greater than 0");
+				fail(ErrCode::INVALID_ARGS);
+			}
+		}
+		else if (arg == "--stdin-format" && i + 1 < argc) {
+			stdin_format = argv[++i];
+			if (stdin_format != "text" && stdin_format != "raw") {
+				Logger::log_error("--stdin-format expects text or raw");
+				fail(ErrCode::INVALID_ARGS);
+			}
+		}
+		else if (arg == "--huge-pages" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == "off") build_options.huge_pages = PointBufferPool::HugePages::OFF;
+			else if (mode == "thp") build_options.huge_pages = PointBufferPool::HugePages::THP;
+			else if (mode == "hugetlb") build_options.huge_pages = PointBufferPool::HugePages::HUGETLB;
+			else {
+				Logger::log_error("--huge-pages expects off, thp or hugetlb");
+				fail(ErrCode::INVALID_ARGS);
+			}
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			build_options.compute_threads = (uint16_t)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--io-threads" && i + 1 < argc) {
+			build_options.io_threads = (uint16_t)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--numa") {
+			build_options.numa_pinning = true;
+		}
+		else if (arg == "--max-in-core" && i + 1 < argc) {
+			build_options.max_points_in_core = (uint64_t)parse_list(arg, argv[++i], 1)[0];
+			if (build_options.max_points_in_core == 0) {
+				Logger::log_error("--max-in-core expects a number of points");
+				fail(ErrCode::INVALID_ARGS);
+			}
+		}
+		else if (arg == "--adaptive-split") {
+			build_options.adaptive_split = true;
+		}
+		else if (arg == "--fifo") {
+			build_options.priority_scheduling = false;
+		}
+		else if (arg == "--distribute-depth" && i + 1 < argc) {
+			build_options.distribute_depth = (uint8_t)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--workers" && i + 1 < argc) {
+			num_local_workers = (uint32_t)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--port" && i + 1 < argc) {
+			serve_port = (uint16_t)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--cache-mb" && i + 1 < argc) {
+			serve_cache_mb = (uint64_t)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--worker") {
+			worker_mode = true;
+		}
+		else if (arg == "--crop-box" && i + 1 < argc) {
+			std::vector<double> v = parse_list(argv[++i]);
+			if (v.size() != 6) {
+				Logger::log_error("--crop-box expects min_x,min_y,min_z,max_x,max_y,max_z");
+				fail(ErrCode::INVALID_ARGS);
+			}
+			filter.set_crop_box({ (float)v[0], (float)v[1], (float)v[2], (float)v[3], (float)v[4], (float)v[5] });
+		}
+		else if (arg == "--crop-polygon" && i + 1 < argc) {
+			try {
+				load_crop_polygon(argv[++i], filter);
+			}
+			catch (const std::exception& e) {
+				Logger::log_error(e.what());
+				fail(ErrCode::INVALID_ARGS);
+			}
+		}
+		else if (arg == "--classes" && i + 1 < argc) {
+			std::vector<uint8_t> classes;
+			for (double c : parse_list(argv[++i])) classes.push_back((uint8_t)c);
+			filter.set_classes(classes);
+		}
+		else if (arg == "--returns" && i + 1 < argc) {
+			std::string r = argv[++i];
+			if (r == "first") filter.set_return_filter(IngestFilter::ReturnFilter::FIRST);
+			else if (r == "last") filter.set_return_filter(IngestFilter::ReturnFilter::LAST);
+			else if (r == "single") filter.set_return_filter(IngestFilter::ReturnFilter::SINGLE);
+			else filter.set_return_filter(IngestFilter::ReturnFilter::NUMBER, (uint8_t)parse_list(arg, r, 1)[0]);
+		}
+		else if (arg == "--voxel-size" && i + 1 < argc) {
+			filter.set_voxel_size(parse_list(arg, argv[++i], 1)[0]);
+		}
+		else if (arg.rfind("--", 0) == 0) {
+			Logger::log_error("Unknown option '" + arg + "'");
+			fail(ErrCode::INVALID_ARGS);
+		}
+		else {
+			args.push_back(arg);
+		}
+	}
+
+	if (!args.empty() && args[0] == "serve") {
+		// serve <octree directory>: answer node requests of viewers until the process is stopped
+		if (args.size() != 2) {
+			Logger::log_error("Invalid arguments");
+			fail(ErrCode::INVALID_ARGS);
+		}
+		uint16_t serve_threads = build_options.compute_threads;
+		if (!serve_threads) serve_threads = (uint16_t)std::clamp<uint32_t>(get_available_cores(), SERVE_MIN_THREADS, UINT16_MAX);
+		try {
+			TileServer server(args[1], serve_port, serve_cache_mb << 20, serve_threads);
+			server.run();
+		}
+		catch (const std::exception& e) {
+			Logger::log_error("Error serving: " + std::string(e.what()));
+			fail(ErrCode::SERVE_FAIL);
+		}
+		return 0;
+	}
+
+	if (worker_mode) {
+		// A worker only needs the shared output directory of a distributed build
+		if (args.size() != 1) {
+			Logger::log_error("Invalid arguments");
+			fail(ErrCode::INVALID_ARGS);
+		}
+		Logger::add_thread_alias("WORK");
+		try {
+			uint64_t jobs = run_worker(args[0], build_options.compute_threads, build_options.io_threads);
+			Logger::log_info("Worker done, built " + std::to_string(jobs) + " subtrees");
+		}
+		catch (const std::exception& e) {
+			Logger::log_error("Error in worker: " + std::string(e.what()));
+			fail(ErrCode::BUILD_FAIL);
+		}
+		return 0;
+	}
+
+	if (args.size() != 2) {
 		Logger::log_error("Invalid arguments");
 		fail(ErrCode::INVALID_ARGS);
 	}
+	if (num_local_workers && !build_options.distribute_depth) build_options.distribute_depth = 2;
+	const std::string input_path = args[0];
+	const std::string output_path = args[1];
+
+	// "-" reads points from stdin, as text or as raw points (--stdin-format)
+	bool from_stdin = input_path == "-";
+	if (from_stdin && (build_options.non_redundant || build_options.distribute_depth)) {
+		Logger::log_error("Input from stdin does not support --non-redundant or distributed builds");
+		fail(ErrCode::INVALID_ARGS);
+	}
 
-	bool is_dir = std::filesystem::is_directory(argv[1]);
+	bool is_dir = !from_stdin && std::filesystem::is_directory(input_path);
 	std::vector<std::string> input_files;
 	if (is_dir) {
-		const std::string ext = ".las";
 		// Iterate through all files in directory
-		for (auto& p : std::filesystem::recursive_directory_iterator(argv[1])) {
-			if (p.path().extension() == ext) input_files.push_back(p.path().string());
+		for (auto& p : std::filesystem::recursive_directory_iterator(input_path)) {
+			int format = get_point_file_format(p.path().string());
+			if (format == POINT_FILE_FORMAT_LAS || format == POINT_FILE_FORMAT_LAZ || format == POINT_FILE_FORMAT_PTS)
+				input_files.push_back(p.path().string());
 		}
 		if (input_files.size() == 0) {
 			Logger::log_error("No input files in directory");
 			fail(ErrCode::INVALID_ARGS);
 		}
 	}
-	else {
-		if (!check_file(argv[1])) {
+	else if (!from_stdin) {
+		if (!check_file(input_path)) {
 			Logger::log_error("Could not open input file");
 			fail(ErrCode::INVALID_ARGS);
 		}
-		input_files.push_back(argv[1]);
+		input_files.push_back(input_path);
+	}
+	if (!LazPointReader::is_supported()) {
+		for (const std::string& file : input_files) {
+			if (get_point_file_format(file) != POINT_FILE_FORMAT_LAZ) continue;
+			Logger::log_error("LAZ input requires building with LASzip ('" + file + "')");
+			fail(ErrCode::INVALID_ARGS);
+		}
 	}
 
-	std::filesystem::create_directories(argv[2]);
+	std::filesystem::create_directories(output_path);
 
-	if (!is_directory_empty(argv[2])) {
+	if (!is_directory_empty(output_path)) {
 		Logger::log_error("Output directory must be empty");
 		fail(ErrCode::OUT_NOT_EMPTY);
 	}
 
+	// Size the thread pools once, before the output directory fills up
+	if (!build_options.compute_threads) build_options.compute_threads = (uint16_t)std::min<uint32_t>(get_available_cores(), UINT16_MAX);
+	if (!build_options.io_threads) build_options.io_threads = probe_io_threads(output_path);
+	std::string pinning;
+	if (build_options.numa_pinning) {
+		size_t num_nodes = get_numa_nodes().size();
+		pinning = num_nodes ? " pinned to " + std::to_string(num_nodes) + " NUMA nodes" : " (single NUMA node, not pinned)";
+	}
+	Logger::log_info("Using " + std::to_string(build_options.compute_threads) + " compute and "
+		+ std::to_string(build_options.io_threads) + " I/O threads" + pinning);
+
 	auto start_time = std::chrono::high_resolution_clock::now();
 
-	//Reader r(input_files, argv[2]);
+	// Read all input headers once, reusing the manifest of an earlier run where possible
+	InputManifest manifest;
+	size_t num_cached = 0;
+	auto save_manifest = [&] {
+		if (!use_manifest || (manifest.get_num_scanned() == 0 && manifest.size() == num_cached)) return;
+		try {
+			manifest.save(manifest_path);
+		}
+		catch (const std::exception& e) {
+			Logger::log_warning("Could not write input manifest: " + std::string(e.what()));
+		}
+	};
+	if (!from_stdin) {
+		if (manifest_path.empty()) manifest_path = get_manifest_file(input_path, is_dir);
+		if (use_manifest && manifest.load(manifest_path)) {
+			num_cached = manifest.size();
+			Logger::log_info("Loaded input manifest (" + std::to_string(num_cached) + " files)");
+		}
+
+		// New text files have no header, they are streamed into a growing octree instead of
+		// being parsed once for their bounds and once more for the split. Non-redundant and
+		// distributed builds need the bounds up front.
+		bool stream_text_files = !build_options.non_redundant && !build_options.distribute_depth;
+		try {
+			manifest.scan(input_files, build_options.io_threads, !stream_text_files);
+		}
+		catch (const std::exception& e) {
+			Logger::log_error("Invalid input: " + std::string(e.what()));
+			fail(ErrCode::INVALID_ARGS);
+		}
+		Logger::log_info("Scanned " + std::to_string(manifest.get_num_scanned()) + " of "
+			+ std::to_string(input_files.size()) + " input headers");
+	}
+
+	if (from_stdin || !manifest.get_unscanned_files().empty()) {
+		// The point count and bounds are only known once the input ends, so the octree grows while reading
+		std::unique_ptr<PointReader> reader;
+		if (from_stdin) {
+			if (stdin_format == "raw") {
+				std::unique_ptr<RawPointReader> r(new RawPointReader);
+				r->open(stdin);
+				reader = std::move(r);
+			}
+			else {
+				std::unique_ptr<TextPointReader> r(new TextPointReader(build_options.compute_threads));
+				r->open(stdin);
+				reader = std::move(r);
+			}
+			Logger::log_info("Reading points from stdin...");
+		}
+		else {
+			Logger::log_info("Streaming the input, " + std::to_string(manifest.get_unscanned_files().size()) + " text files have no cached bounds...");
+		}
+
+		Node* root_node;
+		uint64_t num_points = 0;
+		try {
+			StreamBuilder b(output_path, 15'000, 15'000, &filter, build_options);
+			root_node = from_stdin ? b.build(*reader, num_points) : b.build(input_files, &manifest, num_points);
+		}
+		catch (const std::exception& e) {
+			Logger::log_error("Error building:");
+			Logger::log_error(e.what());
+			fail(ErrCode::BUILD_FAIL);
+			return 0;
+		}
+		save_manifest();
+
+		Logger::log_info("Writing hierarchy...");
+		write_hierarchy(root_node, output_path + "/hierarchy.bin");
+		if (!build_options.attributes.empty()) build_options.attributes.save(output_path + "/attributes.txt");
+		delete_hierarchy(root_node);
+
+		uint64_t total_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+		Logger::log_info("Total time: " + std::to_string(total_time) + "ms");
+		return 0;
+	}
+	save_manifest();
 
 	uint64_t num_points = 0;
-	Cube bounding_cube = LasPointReader::get_big_bounding_cube(input_files, num_points);
+	Cube bounding_cube = manifest.get_bounding_cube(num_points);
 
 	Logger::log_info("Bounds: " + bounding_cube.to_string());
 
-	Builder b(bounding_cube, num_points, argv[2], 15'000, 15'000, input_files);
+	Builder b(bounding_cube, num_points, output_path, 15'000, 15'000, input_files, &manifest, &filter, build_options);
 
 	Logger::log_info("Building octree...");
 	auto sub_start_time = std::chrono::high_resolution_clock::now();
 
+	std::vector<std::future<int>> local_workers;
+	if (build_options.distribute_depth) {
+		write_build_config(output_path, 15'000, 15'000, build_options);
+		local_workers = spawn_local_workers(argv[0], output_path, num_local_workers);
+	}
+
 	Node* root_node;
 	try {
 		root_node = b.build();
+
+		if (build_options.distribute_depth) {
+			finish_submitting(output_path);
+			std::vector<Node*> remote_nodes = b.get_remote_nodes();
+			Logger::log_info("Waiting for " + std::to_string(remote_nodes.size()) + " subtrees...");
+			// The coordinator builds subtrees as well until none are left
+			run_worker(output_path, build_options.compute_threads, build_options.io_threads);
+			merge_subtrees(remote_nodes, output_path);
+			for (auto& w : local_workers) w.wait();
+			std::filesystem::remove_all(get_jobs_directory(output_path));
+		}
 	}
-	catch (std::exception e) {
+	catch (const std::exception& e) {
 		Logger::log_error("Error building:");
 		Logger::log_error(e.what());
-		std::cin.get();
 		fail(ErrCode::BUILD_FAIL);
 		return 0;
 	}
@@ -99,7 +461,8 @@ int main(int argc, char* argv[]) {
 	Logger::log_info("Building took " + std::to_string(sub_time) + "ms");
 
 	Logger::log_info("Writing hierarchy...");
-	write_hierarchy(root_node, std::string(argv[2]) + "/hierarchy.bin");
+	write_hierarchy(root_node, output_path + "/hierarchy.bin");
+	if (!build_options.attributes.empty()) build_options.attributes.save(output_path + "/attributes.txt");
 
 #if _DEBUG
 	// Count all points for debugging purposes
@@ -110,7 +473,7 @@ int main(int argc, char* argv[]) {
 	Logger::log_info("Total nodes:\t" + std::to_string(total_nodes));
 #endif
 
-	delete root_node;
+	delete_hierarchy(root_node);
 
 	sub_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
 	Logger::log_info("Total time: " + std::to_string(sub_time) + "ms");
@@ -0,0 +1,162 @@
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include "Logger.h"
+#include "OctreeReader.h"
+
+// Command line front end of the octree reader:
+// pcc-query <octree directory> [--box min_x,min_y,min_z,max_x,max_y,max_z] [--frustum m0,...,m15]
+//     [--camera x,y,z] [--fov degrees] [--screen-height pixels] [--max-error pixels]
+//     [--budget points] [--skip-refined] [--cache-mb mb] [--threads n] [--nodes] [--out points.bin]
+
+enum class ErrCode {
+	INVALID_ARGS = 1,
+	QUERY_FAIL = 2,
+};
+
+void fail(ErrCode code) {
+	Logger::log_error("Query failed (error code " + std::to_string((int)code) + ")");
+	exit((int)code);
+}
+
+// Parse a comma separated list of numbers
+std::vector<double> parse_list(const std::string& s) {
+	std::vector<double> values;
+	std::stringstream stream(s);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		try {
+			values.push_back(std::stod(item));
+		}
+		catch (const std::exception&) {
+			Logger::log_error("Invalid number '" + item + "'");
+			fail(ErrCode::INVALID_ARGS);
+		}
+	}
+	return values;
+}
+
+std::vector<double> parse_list(const std::string& option, const std::string& s, size_t count) {
+	std::vector<double> values = parse_list(s);
+	if (values.size() != count) {
+		Logger::log_error(option + " expects " + std::to_string(count) + " values");
+		fail(ErrCode::INVALID_ARGS);
+	}
+	return values;
+}
+
+int main(int argc, char* argv[]) {
+	Logger::add_thread_alias("MAIN");
+
+	std::vector<std::string> args;
+	OctreeQuery query;
+	uint64_t cache_mb = 1024;
+	uint32_t num_threads = 0;
+	bool list_nodes = false;
+	std::string out_path;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--box" && i + 1 < argc) {
+			std::vector<double> v = parse_list(arg, argv[++i], 6);
+			query.use_box = true;
+			query.box.min_x = (float)v[0]; query.box.min_y = (float)v[1]; query.box.min_z = (float)v[2];
+			query.box.max_x = (float)v[3]; query.box.max_y = (float)v[4]; query.box.max_z = (float)v[5];
+		}
+		else if (arg == "--frustum" && i + 1 < argc) {
+			std::vector<double> v = parse_list(arg, argv[++i], 16);
+			float m[16];
+			for (int j = 0; j < 16; j++) m[j] = (float)v[j];
+			query.use_frustum = true;
+			query.frustum = Frustum::from_matrix(m);
+		}
+		else if (arg == "--camera" && i + 1 < argc) {
+			std::vector<double> v = parse_list(arg, argv[++i], 3);
+			query.use_camera = true;
+			query.camera_x = (float)v[0]; query.camera_y = (float)v[1]; query.camera_z = (float)v[2];
+		}
+		else if (arg == "--fov" && i + 1 < argc) {
+			query.fov_y = (float)(parse_list(arg, argv[++i], 1)[0] * 3.14159265358979 / 180.0);
+		}
+		else if (arg == "--screen-height" && i + 1 < argc) {
+			query.screen_height = (float)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--max-error" && i + 1 < argc) {
+			query.max_error = (float)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--budget" && i + 1 < argc) {
+			query.point_budget = (uint64_t)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--cache-mb" && i + 1 < argc) {
+			cache_mb = (uint64_t)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			num_threads = (uint32_t)parse_list(arg, argv[++i], 1)[0];
+		}
+		else if (arg == "--skip-refined") {
+			query.skip_refined = true;
+		}
+		else if (arg == "--nodes") {
+			list_nodes = true;
+		}
+		else if (arg == "--out" && i + 1 < argc) {
+			out_path = argv[++i];
+		}
+		else if (arg.rfind("--", 0) == 0) {
+			Logger::log_error("Unknown option '" + arg + "'");
+			fail(ErrCode::INVALID_ARGS);
+		}
+		else {
+			args.push_back(arg);
+		}
+	}
+
+	if (args.size() != 1) {
+		Logger::log_error("Invalid arguments");
+		fail(ErrCode::INVALID_ARGS);
+	}
+
+	try {
+		auto start_time = std::chrono::high_resolution_clock::now();
+		OctreeReader reader(args[0], cache_mb << 20, num_threads);
+		uint64_t open_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+		Logger::log_info("Loaded hierarchy with " + std::to_string(reader.get_nodes().size()) + " nodes in " + std::to_string(open_time) + "ms");
+
+		start_time = std::chrono::high_resolution_clock::now();
+		std::vector<uint32_t> selected = reader.select_nodes(query);
+		uint64_t select_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+		Logger::log_info("Selected " + std::to_string(selected.size()) + " nodes in " + std::to_string(select_time) + "us");
+		if (list_nodes) {
+			for (uint32_t i : selected) {
+				const OctreeNode& node = reader.get_nodes()[i];
+				Logger::log_raw("p" + node.id + " " + std::to_string(node.num_points) + " " + std::to_string(node.spacing) + "\n");
+			}
+		}
+
+		FILE* out_file = nullptr;
+		if (!out_path.empty()) {
+			out_file = fopen(out_path.c_str(), "wb");
+			if (!out_file) throw std::runtime_error("Could not open output file");
+		}
+
+		std::mutex out_lock;
+		uint64_t num_points = 0;
+		start_time = std::chrono::high_resolution_clock::now();
+		reader.query_points(query, [&](const OctreeNode&, const Point* points, uint64_t n) {
+			std::lock_guard<std::mutex> guard(out_lock);
+			num_points += n;
+			if (out_file) fwrite(points, sizeof(struct Point), n, out_file);
+		});
+		uint64_t query_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+		if (out_file) fclose(out_file);
+
+		Logger::log_info("Returned " + std::to_string(num_points) + " points in " + std::to_string(query_time) + "ms ("
+			+ std::to_string(reader.get_cache().get_misses()) + " nodes loaded)");
+	}
+	catch (const std::exception& e) {
+		Logger::log_error(e.what());
+		fail(ErrCode::QUERY_FAIL);
+	}
+	return 0;
+}